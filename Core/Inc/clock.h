@@ -0,0 +1,37 @@
+/*
+ * clock.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: Victor Kalenda
+ */
+
+#include <stdint.h>
+
+#ifndef INC_CLOCK_H_
+#define INC_CLOCK_H_
+
+/*
+ * System clock profiles
+ * CLOCK_PROFILE_HSE_8MHZ: The 8MHz crystal directly with zero flash wait states, the boot clock and the default.
+ * 						  Lowest power and the profile used while the bus is idle
+ * CLOCK_PROFILE_HSI_24MHZ: HSI48 / 2, the fastest rate that still runs with zero flash wait states
+ * CLOCK_PROFILE_HSI_48MHZ: HSI48 undivided with one flash wait state, full speed
+ */
+typedef enum clock_profile_e
+{
+	CLOCK_PROFILE_HSE_8MHZ,
+	CLOCK_PROFILE_HSI_24MHZ,
+	CLOCK_PROFILE_HSI_48MHZ,
+	NUM_CLOCK_PROFILES
+}clock_profile_t;
+
+#define CLOCK_PROFILE_LOW_POWER CLOCK_PROFILE_HSE_8MHZ
+#define CLOCK_IDLE_TIMEOUT 50 // ms of bus silence before dropping to the low power profile
+
+int8_t clock_set_profile(uint8_t profile);
+uint8_t clock_get_profile();
+int8_t clock_restore();
+int8_t clock_service(uint8_t profile, uint8_t scaling, uint8_t bus_idle);
+int8_t clock_wake();
+
+#endif /* INC_CLOCK_H_ */
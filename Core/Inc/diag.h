@@ -0,0 +1,26 @@
+/*
+ * diag.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: Victor Kalenda
+ */
+
+#include <stdint.h>
+
+#ifndef INC_DIAG_H_
+#define INC_DIAG_H_
+
+/*
+ * Error counters
+ * Every error code from 0x01 (HAL_ERROR) to EE_WRITE_ERROR passed to handle_modbus_error() has a saturating 32 bit
+ * counter, which may be incremented from interrupt context.
+ * Writing any value to ERROR_SNAPSHOT copies the counters into the ERROR_COUNT input registers and clears them in
+ * one step, so the host reads the errors of a known interval without racing new ones:
+ * ERROR_COUNT_START + (code - 1) * 2 holds the high word of the count for code, the low word follows.
+ */
+
+void diag_count(int8_t error_code);
+void diag_snapshot();
+void diag_export(uint16_t *registers);
+
+#endif /* INC_DIAG_H_ */
@@ -40,4 +40,19 @@
 #define I2C_ERROR					0x18
 #define I2C_FATAL_ERROR				0x19
 
+// EEPROM Error Codes
+#define EE_WRITE_ERROR				0x1A
+
+#define NUM_ERROR_CODES				EE_WRITE_ERROR // Codes 0x01 to EE_WRITE_ERROR are counted, see diag.h
+
+/*
+ * MB_ERRORS bit layout, a bit stays set until the host clears it
+ * Bits 0 to 12: code - RANGE_ERROR, for codes RANGE_ERROR (0x0E) to EE_WRITE_ERROR (0x1A)
+ * Bits 13, 14: unused, always 0
+ * Bit 15: any HAL error (0x01 to 0x03)
+ * Modbus exception codes are counted (diag.h) but not flagged
+ */
+#define MB_ERRORS_HAL_BIT			15
+#define MB_ERRORS_MASK				(((1U << (EE_WRITE_ERROR - RANGE_ERROR + 1)) - 1) | (1U << MB_ERRORS_HAL_BIT))
+
 #endif /* APPLICATION_USER_CORE_CUSTOM_LAYERS_ERROR_CODES_H_ */
@@ -0,0 +1,68 @@
+/*
+ * fault.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: Victor Kalenda
+ */
+
+#include <stdint.h>
+
+#ifndef INC_FAULT_H_
+#define INC_FAULT_H_
+
+/*
+ * HardFault capture
+ * HardFault_Capture_Handler (startup_stm32c071cbtx.s) hands the exception frame to fault_capture() before
+ * HardFault_Handler resets the board. The record is kept in the .noinit RAM section, which the startup code neither
+ * copies nor clears, so it survives the reset; its CRC tells a record from the random contents of RAM at power up.
+ * The Cortex-M0+ has no fault status registers, the exception that was running when the fault hit is the only source.
+ * The last record is read from FAULT_START in input registers, 32 bit values high word first, all 0 until a fault:
+ * [0..1]   Faults since power up
+ * [2]      Source, the exception number from the stacked xPSR: 0 the super-loop, 15 SysTick, 16 + IRQn an interrupt
+ * [3..4]   HAL tick in ms
+ * [5..6]   PC
+ * [7..8]   LR
+ * [9..10]  xPSR
+ * [11..12] R0
+ * [13..14] R1
+ * [15..16] R2
+ * [17..18] R3
+ * [19..20] R12
+ * [21..22] SP before the exception
+ * [23..24] EXC_RETURN, bit 2 set if the frame was on the process stack
+ * If the frame was not in RAM (a stack overflow) the stacked registers read 0 and SP holds the address of the frame.
+ */
+#define FAULT_MAGIC 0x464C5421
+#define FAULT_BLOCK_SIZE 25
+
+typedef enum fault_frame_e
+{
+	FAULT_R0,
+	FAULT_R1,
+	FAULT_R2,
+	FAULT_R3,
+	FAULT_R12,
+	FAULT_LR,
+	FAULT_PC,
+	FAULT_XPSR,
+	NUM_FAULT_FRAME_WORDS
+}fault_frame_t;
+
+typedef struct fault_record_s
+{
+	uint32_t magic;
+	uint32_t count;
+	uint32_t tick;
+	uint32_t frame[NUM_FAULT_FRAME_WORDS]; // As stacked, indexed by fault_frame_t
+	uint32_t sp;
+	uint32_t exc_return;
+	uint8_t source;
+	uint8_t reported; // Set once the fault has been journaled
+	uint16_t crc; // Modbus CRC-16 of the bytes before it
+}fault_record_t;
+
+void fault_capture(const uint32_t *frame, uint32_t exc_return);
+const fault_record_t *fault_unreported();
+void fault_export(uint16_t *registers);
+
+#endif /* INC_FAULT_H_ */
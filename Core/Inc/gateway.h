@@ -0,0 +1,29 @@
+/*
+ * gateway.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: Victor Kalenda
+ */
+
+#include <stdint.h>
+
+#ifndef INC_GATEWAY_H_
+#define INC_GATEWAY_H_
+
+/*
+ * Gateway mode (MB_SLAVE and MB_MASTER both defined)
+ * The board polls up to four downstream devices as master on USART2 and mirrors their registers into the
+ * input register bank served on USART1, so the host collects every meter and breaker in a single read.
+ * Entry n is configured through GATEWAY_n_ID (0 leaves it unused), GATEWAY_n_FUNCTION (0x03 or 0x04),
+ * GATEWAY_n_ADDRESS, GATEWAY_n_COUNT (1 to GATEWAY_MIRROR_SIZE) and GATEWAY_n_INTERVAL (ms).
+ * Its registers appear at GATEWAY_MIRROR_START + (n - 1) * GATEWAY_MIRROR_SIZE, bit n - 1 of GATEWAY_STATUS is set
+ * while the last poll succeeded, a failed poll leaves the previous values in place and counts in GATEWAY_ERRORS.
+ * Each entry owns the master schedule slot of the same index, a poll waits GATEWAY_TIMEOUT ms for its response
+ * and is retried MB_TRANSMIT_RETRIES times before it counts as failed.
+ */
+
+void gateway_restore();
+void gateway_store();
+void gateway_service();
+
+#endif /* INC_GATEWAY_H_ */
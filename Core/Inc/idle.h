@@ -0,0 +1,47 @@
+/*
+ * idle.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: Victor Kalenda
+ */
+
+#include <stdint.h>
+
+#ifndef INC_IDLE_H_
+#define INC_IDLE_H_
+
+/*
+ * Idle policy for the super-loop
+ * IDLE_MODE_RUN: Never sleep, the super-loop polls continuously
+ * IDLE_MODE_SLEEP: Sleep (WFI) until the next interrupt whenever there is no pending work, SysTick still wakes the
+ * 				    core every 1 ms
+ * IDLE_MODE_STOP: As above, but enter Stop mode when the bus is quiet and the next software timer is at least 1 ms
+ * 				   away. USART1 (start bit), the EXTI inputs, the DMA and the RTC alarm, programmed for the next software
+ * 				   timer, remain able to wake the core. The RTC runs from the LSI, so the software time base drifts
+ * 				   with the LSI tolerance while in Stop.
+ */
+typedef enum idle_mode_e
+{
+	IDLE_MODE_RUN,
+	IDLE_MODE_SLEEP,
+	IDLE_MODE_STOP,
+	NUM_IDLE_MODES
+}idle_mode_t;
+
+typedef struct idle_stats_s
+{
+	uint32_t sleep_count;
+	uint32_t stop_count;
+	uint32_t sleep_time_ms;
+	uint32_t sleep_time_us; // Sub-millisecond remainder of sleep_time_ms
+	uint16_t wake_latency;
+	uint16_t wake_latency_max;
+}idle_stats_t;
+
+extern idle_stats_t idle_stats;
+
+void idle_init();
+void idle_enter(uint8_t mode, uint8_t bus_idle);
+void idle_rtc_irq_handler();
+
+#endif /* INC_IDLE_H_ */
@@ -0,0 +1,75 @@
+/*
+ * journal.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: Victor Kalenda
+ */
+
+#include <stdint.h>
+
+#ifndef INC_JOURNAL_H_
+#define INC_JOURNAL_H_
+
+/*
+ * Event journal
+ * Trips and faults are kept in JOURNAL_PAGES flash pages just below the emulated EEPROM page, so they survive a power
+ * cycle. Records are appended to the pages in turn, each with a sequence number and a CRC, and the oldest page is
+ * erased when the newest one is full, so at least one page of history is always held.
+ * journal_log() only queues a record, the queue is committed by journal_service() JOURNAL_COMMIT_DELAY ms after the
+ * first record in it, so a burst of events costs one flash write. Events logged in the last second before power is
+ * lost are not kept.
+ * The flash is rated for few erase cycles, so a chattering source cannot wear it out: every record spends a token
+ * from a bucket of JOURNAL_BURST, refilled by one every JOURNAL_REFILL_TIME ms. Records queued without a token, or
+ * while the queue is full, are dropped and counted.
+ *
+ * The journal is read as file MB_FILE_JOURNAL with function code 0x14 (read file record), one register per record number:
+ * [0..1]   Sequence number of the next record, high word first
+ * [2]      Records dropped since power up
+ * [3]      JOURNAL_ENTRY_SIZE
+ * [4..]    JOURNAL_SLOTS slots, oldest page first, JOURNAL_ENTRY_SIZE registers each:
+ *          [0..1] Sequence number, high word first
+ *          [2..3] TIM2 time in us, high word first
+ *          [4]    Power up count, every JOURNAL_RESET record starts a new one
+ *          [5]    journal_event_t (high byte), detail (low byte)
+ *          [6]    Data
+ * A slot that has not been written yet, or was damaged by a power loss while it was written, reads as JOURNAL_EMPTY.
+ */
+#define JOURNAL_PAGES 2
+#define JOURNAL_PAGE_RECORDS 128 // 16 byte records in a 2KB page
+#define JOURNAL_SLOTS (JOURNAL_PAGES * JOURNAL_PAGE_RECORDS)
+#define JOURNAL_QUEUE_SIZE 8
+#define JOURNAL_COMMIT_DELAY 1000 // ms
+#define JOURNAL_BURST 16
+#define JOURNAL_REFILL_TIME 60000 // ms
+#define JOURNAL_ENTRY_SIZE 7
+#define JOURNAL_FILE_HEADER 4
+#define JOURNAL_FILE_SIZE (JOURNAL_FILE_HEADER + JOURNAL_SLOTS * JOURNAL_ENTRY_SIZE)
+
+typedef enum journal_event_e
+{
+	JOURNAL_EMPTY = 0x00,
+	JOURNAL_RESET = 0x01, // Detail: the reset flags, bits 31 to 24 of RCC_CSR2
+	JOURNAL_HARDFAULT = 0x02, // Follows JOURNAL_RESET after a HardFault. Detail: fault source, data: (PC - FLASH_BASE) / 2, see fault.h
+	JOURNAL_WATCHDOG = 0x03, // Detail: GPIO_WRITE when the relays were turned off
+	JOURNAL_ESTOP = 0x04, // Detail: the new ESTOP_SENSE level
+	JOURNAL_MANUAL = 0x05, // Detail: 1 when the board is put in manual mode, 0 when it returns to Modbus control
+	JOURNAL_UART_FATAL = 0x06 // Detail: modbus_port_id_t, data: HAL status of the failed reset, logged once until the port recovers
+}journal_event_t;
+
+typedef struct journal_record_s
+{
+	uint32_t sequence;
+	uint32_t time;
+	uint16_t boot;
+	uint16_t data;
+	uint8_t event;
+	uint8_t detail;
+	uint16_t crc; // Modbus CRC-16 of the bytes before it
+}journal_record_t;
+
+void journal_init();
+void journal_log(uint8_t event, uint8_t detail, uint16_t data);
+void journal_service();
+int8_t journal_read(uint16_t record, uint16_t length, uint8_t *data);
+
+#endif /* INC_JOURNAL_H_ */
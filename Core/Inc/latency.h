@@ -0,0 +1,63 @@
+/*
+ * latency.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: Victor Kalenda
+ */
+
+#include <stdint.h>
+
+#ifndef INC_LATENCY_H_
+#define INC_LATENCY_H_
+
+/*
+ * Slave transaction latency
+ * Every answered request is timed with TIM2 at five points: its first byte (back-dated from the header or FIFO
+ * interrupt by the characters already received), the end of the frame, modbus_rx() handing it to main(),
+ * modbus_send() and the TX complete interrupt. The stages between them are kept per request type, each as
+ * min / max / mean in us, and the end to end response time also as a histogram with log2 buckets.
+ * The block is read from LATENCY_START in input registers, one LATENCY_CLASS_SIZE group per latency_class_t:
+ * [0..1]   Transactions, high word first
+ * [2..16]  Min, max and mean of each latency_stage_t
+ * [17..24] Response time histogram, bucket 0 counts responses under 256us, bucket n under 256us << n,
+ *          the last bucket everything slower
+ * Writing any value to LATENCY_RESET clears the block.
+ */
+typedef enum latency_event_e
+{
+	LATENCY_FIRST_BYTE,
+	LATENCY_FRAME_END,
+	LATENCY_MAIN,
+	LATENCY_SEND,
+	LATENCY_TX_COMPLETE,
+	NUM_LATENCY_EVENTS
+}latency_event_t;
+
+typedef enum latency_stage_e
+{
+	LATENCY_RECEIVE, // First byte to the end of the frame
+	LATENCY_DISPATCH, // End of the frame to main()
+	LATENCY_PROCESS, // main() to modbus_send()
+	LATENCY_TRANSMIT, // modbus_send() to TX complete, includes the turnaround delay
+	LATENCY_RESPONSE, // End of the frame to TX complete, the response time seen by the master
+	NUM_LATENCY_STAGES
+}latency_stage_t;
+
+typedef enum latency_class_e
+{
+	LATENCY_CLASS_READ_HOLDING, // 0x03
+	LATENCY_CLASS_READ_INPUT, // 0x04
+	LATENCY_CLASS_WRITE_MULTIPLE, // 0x10
+	LATENCY_CLASS_OTHER, // Any other function code, including exception responses to unsupported ones
+	NUM_LATENCY_CLASSES
+}latency_class_t;
+
+#define NUM_LATENCY_BUCKETS 8
+#define LATENCY_BUCKET_SHIFT 8 // Bucket 0 ends at 256us
+#define LATENCY_CLASS_SIZE (2 + NUM_LATENCY_STAGES * 3 + NUM_LATENCY_BUCKETS)
+
+void latency_record(uint8_t function_code, const uint32_t *event_time);
+void latency_reset();
+void latency_export(uint16_t *registers);
+
+#endif /* INC_LATENCY_H_ */
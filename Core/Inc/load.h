@@ -0,0 +1,38 @@
+/*
+ * load.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: Victor Kalenda
+ */
+
+#include <stdint.h>
+
+#ifndef INC_LOAD_H_
+#define INC_LOAD_H_
+
+/*
+ * Super-loop load
+ * Every iteration of the super-loop is timed with TIM2 from its top to the next one (the loop period), split into
+ * the busy part up to the idle decision and the time spent in idle_enter() afterwards, interrupts included in both.
+ * The busy part is the longest the loop can take to notice new work, so its maximum is the longest blocking section.
+ * Rate and idle share are measured over windows of LOAD_WINDOW us, the period and busy statistics since the last reset.
+ * The core clocks, TIM2 included, stop in Stop mode, so time spent there is left out of every figure.
+ * The block is read from LOAD_START in input registers, 32 bit values high word first:
+ * [0..1]   Iterations in the last window, per second
+ * [2]      Share of the last window spent in idle_enter(), in 0.01%, always 0 with IDLE_MODE_RUN
+ * [3..4]   Iterations since the reset
+ * [5..6]   Minimum loop period in us
+ * [7..8]   Maximum loop period in us
+ * [9..10]  Mean loop period in us
+ * [11..12] Longest busy part of an iteration in us
+ * Writing any value to LOAD_RESET clears the statistics and starts a new window.
+ */
+#define LOAD_WINDOW 1000000 // us
+#define LOAD_BLOCK_SIZE 13
+
+void load_loop();
+void load_busy_end();
+void load_reset();
+void load_export(uint16_t *registers);
+
+#endif /* INC_LOAD_H_ */
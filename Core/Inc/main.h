@@ -31,6 +31,11 @@ extern "C" {
 
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
+#include "latency.h"
+#include "load.h"
+#include "ram.h"
+#include "fault.h"
+#include "error_codes.h"
 
 /* USER CODE END Includes */
 
@@ -46,9 +51,172 @@ typedef enum holding_register_e
 	GPIO_READ,
 	GPIO_WRITE,
 	WDG_TIMEOUT,
+	IDLE_MODE,
+	CLOCK_PROFILE,
+	CLOCK_SCALING,
+	MB_BAUD_HIGH,
+	MB_BAUD_LOW,
+	MB_AUTO_BAUD,
+	MB_BAUD_PROBATION,
+	MB_GROUP_1,
+	MB_GROUP_2,
+	MB_GROUP_3,
+	MB_GROUP_4,
+	SYNC_EPOCH_HIGH,
+	SYNC_EPOCH_LOW,
+	SCHEDULE_GPIO,
+	SCHEDULE_TIME_HIGH,
+	SCHEDULE_TIME_LOW,
+	RELAY_STAGGER_MODE,
+	RELAY_STAGGER_SLOT,
+	RELAY_STAGGER_SLOTS,
+	RELAY_STAGGER_STEP,
+	MB2_BAUD_RATE,
+	MB2_ROLE,
+	MB2_ID,
+	WDG_PORTS,
+	GATEWAY_TIMEOUT,
+	GATEWAY_1_ID,
+	GATEWAY_1_FUNCTION,
+	GATEWAY_1_ADDRESS,
+	GATEWAY_1_COUNT,
+	GATEWAY_1_INTERVAL,
+	GATEWAY_2_ID,
+	GATEWAY_2_FUNCTION,
+	GATEWAY_2_ADDRESS,
+	GATEWAY_2_COUNT,
+	GATEWAY_2_INTERVAL,
+	GATEWAY_3_ID,
+	GATEWAY_3_FUNCTION,
+	GATEWAY_3_ADDRESS,
+	GATEWAY_3_COUNT,
+	GATEWAY_3_INTERVAL,
+	GATEWAY_4_ID,
+	GATEWAY_4_FUNCTION,
+	GATEWAY_4_ADDRESS,
+	GATEWAY_4_COUNT,
+	GATEWAY_4_INTERVAL,
+	TELEMETRY_MODE,
+	TELEMETRY_INTERVAL,
+	LATENCY_RESET,
+	ERROR_SNAPSHOT,
+	PROFILE_CONTROL,
+	LOAD_RESET,
 	NUM_HOLDING_REGISTERS
 }holding_register_t;
 
+typedef enum input_register_e
+{
+	SLEEP_COUNT_HIGH,
+	SLEEP_COUNT_LOW,
+	STOP_COUNT_HIGH,
+	STOP_COUNT_LOW,
+	SLEEP_TIME_HIGH,
+	SLEEP_TIME_LOW,
+	WAKE_LATENCY,
+	WAKE_LATENCY_MAX,
+	SYSCLK_KHZ,
+	MB_BAUD_ACTUAL_HIGH,
+	MB_BAUD_ACTUAL_LOW,
+	MB_BAUD_ERROR,
+	MB_FRAME_COUNT_HIGH,
+	MB_FRAME_COUNT_LOW,
+	MB_OVERRUN_COUNT_HIGH,
+	MB_OVERRUN_COUNT_LOW,
+	MB_IRQ_PER_FRAME,
+	MB_IRQ_PER_FRAME_MAX,
+	MB_FILTERED_COUNT_HIGH,
+	MB_FILTERED_COUNT_LOW,
+	SYNC_STATE,
+	SYNC_TIME_HIGH,
+	SYNC_TIME_LOW,
+	SCHEDULE_SKEW,
+	SCHEDULE_SKEW_MAX,
+	MB2_FRAME_COUNT_HIGH,
+	MB2_FRAME_COUNT_LOW,
+	MB2_OVERRUN_COUNT_HIGH,
+	MB2_OVERRUN_COUNT_LOW,
+	MB2_FILTERED_COUNT_HIGH,
+	MB2_FILTERED_COUNT_LOW,
+	GATEWAY_STATUS,
+	GATEWAY_ERRORS,
+	GATEWAY_MIRROR_START,
+	GATEWAY_MIRROR_END = GATEWAY_MIRROR_START + 63,
+	TELEMETRY_COUNT_HIGH,
+	TELEMETRY_COUNT_LOW,
+	TELEMETRY_OVERRUNS,
+	LATENCY_START,
+	LATENCY_END = LATENCY_START + NUM_LATENCY_CLASSES * LATENCY_CLASS_SIZE - 1,
+	ERROR_COUNT_START,
+	ERROR_COUNT_END = ERROR_COUNT_START + NUM_ERROR_CODES * 2 - 1,
+	LOAD_START,
+	LOAD_END = LOAD_START + LOAD_BLOCK_SIZE - 1,
+	RAM_START,
+	RAM_END = RAM_START + RAM_BLOCK_SIZE - 1,
+	FAULT_START,
+	FAULT_END = FAULT_START + FAULT_BLOCK_SIZE - 1,
+	NUM_INPUT_REGISTERS
+}input_register_t;
+
+#define NUM_MODBUS_GROUPS (MB_GROUP_4 - MB_GROUP_1 + 1)
+#define GATEWAY_ENTRY_SIZE (GATEWAY_2_ID - GATEWAY_1_ID)
+#define NUM_GATEWAY_ENTRIES ((GATEWAY_4_ID - GATEWAY_1_ID) / GATEWAY_ENTRY_SIZE + 1)
+#define GATEWAY_MIRROR_SIZE ((GATEWAY_MIRROR_END - GATEWAY_MIRROR_START + 1) / NUM_GATEWAY_ENTRIES) // Registers mirrored per entry
+
+/*
+ * Contents of the emulated EEPROM page
+ * Flash is programmed a double word at a time, so the size must stay a multiple of 8 bytes
+ */
+typedef struct ee_storage_s
+{
+	uint32_t modbus_baud_rate;
+	uint8_t gpio_state;
+	uint8_t group_id[NUM_MODBUS_GROUPS];
+	uint8_t modbus_id;
+	uint8_t stagger_mode;
+	uint8_t stagger_slot;
+	uint16_t stagger_step;
+	uint8_t stagger_slots;
+	uint8_t mb2_baud_rate;
+	uint16_t gateway_address[NUM_GATEWAY_ENTRIES];
+	uint16_t gateway_interval[NUM_GATEWAY_ENTRIES];
+	uint8_t gateway_id[NUM_GATEWAY_ENTRIES];
+	uint8_t gateway_function[NUM_GATEWAY_ENTRIES];
+	uint8_t gateway_count[NUM_GATEWAY_ENTRIES];
+	uint16_t gateway_timeout;
+	uint8_t mb2_role;
+	uint8_t mb2_id;
+	uint16_t telemetry_interval;
+	uint8_t telemetry_mode;
+	uint8_t reserved;
+	uint32_t layout; // EE_LAYOUT once this layout has been written
+}ee_storage_t;
+
+/*
+ * Marks a page written with ee_storage_t, anything else (an erased page, or the single gpio_state byte stored by
+ * earlier firmware) is discarded by ee_validate(). Change it whenever the layout changes
+ */
+#define EE_LAYOUT 0x45450001
+
+/*
+ * Power-up stagger (RELAY_STAGGER_MODE)
+ * When the relays are re-energised on leaving manual mode, the 120VAC / 480VAC sequence is held off by
+ * (slot % RELAY_STAGGER_SLOTS) * RELAY_STAGGER_STEP ms, so a fleet spreads its inrush over the window
+ * Entering manual mode always sequences straight away, the operator is at the board
+ * STAGGER_DISABLED: Sequence straight away, the default
+ * STAGGER_MODBUS_ID: slot = MODBUS_ID
+ * STAGGER_UID: slot is a hash of the device UID, for boards that still share the factory ID
+ * STAGGER_SLOT: slot = RELAY_STAGGER_SLOT as programmed by the host
+ */
+typedef enum stagger_mode_e
+{
+	STAGGER_DISABLED,
+	STAGGER_MODBUS_ID,
+	STAGGER_UID,
+	STAGGER_SLOT,
+	NUM_STAGGER_MODES
+}stagger_mode_t;
+
 typedef enum gpio_read_e
 {
 	ESTOP_SENSE_POS,
@@ -6,6 +6,7 @@
  */
 
 #include <stdint.h>
+#include "stm32c0xx_hal.h"
 
 #ifndef INC_MODBUS_H_
 #define INC_MODBUS_H_
@@ -14,16 +15,61 @@
  * Choose what modbus features/capabilities you would like to include for your project
  * MB_MASTER: Include modbus master functions and capabilities
  * MB_SLAVE: Include modbus slave functions and capabilities
+ * With both defined the board is a gateway: USART1 stays the slave port and the master runs on USART2
  */
 #define MB_SLAVE
+#define MB_MASTER
+
+/*
+ * Choose how USART1 receives frames
+ * MB_FIFO_MODE: The 8 byte hardware FIFO is drained by the RX FIFO threshold interrupt and the frame is closed by the
+ * 				 receiver timeout after 3.5 character times of silence. Recommended from 256000 baud, where per byte DMA
+ * 				 requests and the header/body DMA re-arm leave the error path with no slack
+ * Otherwise: Two stage ReceiveToIdle DMA, the 6 byte header followed by the body
+ */
+// #define MB_FIFO_MODE
 
 #define RX_BUFFER_SIZE 125
 
+typedef enum modbus_port_id_e
+{
+	MODBUS_PORT_1, // USART1
+	MODBUS_PORT_2, // USART2
+	NUM_MODBUS_PORTS
+}modbus_port_id_t;
+
+typedef enum modbus_role_e
+{
+	MODBUS_ROLE_DISABLED,
+	MODBUS_ROLE_SLAVE,
+	MODBUS_ROLE_MASTER,
+	NUM_MODBUS_ROLES
+}modbus_role_t;
+
+/*
+ * USART2 runs in the role held in MB2_ROLE, with its own slave ID (MB2_ID) and rate (MB2_BAUD_RATE)
+ * As a slave it serves the same register database as USART1, frames from both ports are handled one at a time by the
+ * super-loop. USART2 cannot wake the core from Stop, so the core stays out of Stop (and at full clock) while it is a slave
+ * The master role is only available when both MB_SLAVE and MB_MASTER are defined, a disabled port may carry the
+ * telemetry stream (telemetry.h) instead
+ * USART2 and its driver enable (PA1) stay idle until the host writes MB2_ROLE, so a board keeps its single port
+ * behaviour until it is commissioned as a gateway
+ */
+#if defined(MB_SLAVE) && defined(MB_MASTER)
+#define MODBUS_MASTER_PORT MODBUS_PORT_2
+#else
+#define MODBUS_MASTER_PORT MODBUS_PORT_1
+#endif
+#define MODBUS_PORT_2_DEFAULT_ROLE MODBUS_ROLE_DISABLED
+#define MB_BROADCAST_ADDRESS 0x00 // Write commands sent here (or to a group ID in MB_GROUP_1 to MB_GROUP_4) are executed without a response
+#define MODBUS_TURNAROUND_DELAY 1 // ms of bus silence given to the master before a write response
+
 // Error Codes
 #define MB_SUCCESS 			0x00
 typedef enum baud_rate_e
 {
-	BAUD_RATE_2400 = 1,
+	BAUD_RATE_CUSTOM, // MB_BAUD_HIGH / MB_BAUD_LOW hold a rate outside of this table
+	BAUD_RATE_2400,
 	BAUD_RATE_4800,
 	BAUD_RATE_9600,
 	BAUD_RATE_19200,
@@ -32,8 +78,153 @@ typedef enum baud_rate_e
 	BAUD_RATE_115200,
 	BAUD_RATE_128000,
 	BAUD_RATE_256000,
+	BAUD_RATE_460800,
+	BAUD_RATE_921600,
+	BAUD_RATE_1000000,
+	BAUD_RATE_2000000,
+	BAUD_RATE_3000000,
+	NUM_BAUD_RATES
 }baud_rate_t;
 
+/*
+ * Auto-baud detection (MB_AUTO_BAUD)
+ * AUTO_BAUD_DISABLED: The board only ever runs at MB_BAUD_HIGH / MB_BAUD_LOW, the power up default so a fresh board
+ * 					   answers at the default rate on any ID. Commissioning enables detection by writing MB_AUTO_BAUD
+ * AUTO_BAUD_ENABLED: Detection starts at power up if no rate has been stored, and after
+ * 					  MODBUS_AUTO_BAUD_ERROR_LIMIT consecutive receive errors
+ * AUTO_BAUD_DETECT: Write to start detection once the response has been sent, reads back until a rate is locked
+ * The rate is measured on the start bit of the first byte, so the locking frame must be sent to an odd address (0xFF works for every board)
+ * and is only accepted once its CRC checks out, after which the rate is stored in the emulated EEPROM
+ */
+typedef enum auto_baud_e
+{
+	AUTO_BAUD_DISABLED,
+	AUTO_BAUD_ENABLED,
+	AUTO_BAUD_DETECT
+}auto_baud_t;
+
+#define MODBUS_AUTO_BAUD_ERROR_LIMIT 8
+
+typedef struct modbus_stats_s
+{
+	uint32_t frames;
+	uint32_t overruns;
+	uint32_t filtered;
+	uint16_t irq_per_frame;
+	uint16_t irq_per_frame_max;
+}modbus_stats_t;
+
+extern modbus_stats_t modbus_stats[NUM_MODBUS_PORTS];
+
+#define MODBUS_MIN_BAUD_RATE 1200
+#define MODBUS_MAX_BAUD_RATE 6000000 // Oversampling by 8 from the 48MHz HSI kernel clock
+#define MODBUS_MAX_BAUD_ERROR 20000 // ppm, the receiver tolerates roughly 2% to 4% depending on the sampling mode
+
+/*
+ * UID enumeration (user defined function code 0x41), always sent to the discovery address 0xFF
+ * Request: 0xFF, 0x41, sub-function, parameter, 0x00, 0x06, 12 byte UID (omitted for ENUMERATE_RESET), CRC
+ * ENUMERATE_SEARCH: Parameter is a prefix length in bits, every board not yet assigned whose UID starts with
+ * 					 the prefix responds with 0xFF, 0x41, 0x01, MODBUS_ID, 0x00, 0x06, UID, CRC.
+ * 					 The response is sent in slot 0 or 1 according to the UID bit following the prefix, a slot
+ * 					 lasts one response frame time, so the master can tell which half of the search space
+ * 					 answered and a corrupted response means more boards need to be split apart.
+ * ENUMERATE_ASSIGN: Parameter is the new MODBUS_ID, only the board with a matching UID takes it, stores it in the
+ * 					 emulated EEPROM, echoes the request and stops answering searches
+ * ENUMERATE_RESET:  Every board answers searches again, no response
+ */
+#define MB_DISCOVERY_ADDRESS 0xFF
+#define MB_ENUMERATE 0x41
+#define MB_UID_SIZE 12
+#define MB_MAX_SLAVE_ID 247
+
+typedef enum enumerate_e
+{
+	ENUMERATE_SEARCH = 0x01,
+	ENUMERATE_ASSIGN,
+	ENUMERATE_RESET
+}enumerate_t;
+
+/*
+ * Diagnostics (function code 0x08), each port keeps its own counters since power up or the last clear
+ * Request: ID, 0x08, sub-function (2 bytes), data (2 bytes), CRC
+ * DIAGNOSTIC_RETURN_QUERY_DATA: Any amount of data is echoed back
+ * DIAGNOSTIC_RESTART_COMMS: Data 0x0000 or 0xFF00, clears the counters and echoes the request, there is no listen only
+ * 							 mode or event log to restart
+ * DIAGNOSTIC_CLEAR_COUNTERS, DIAGNOSTIC_CLEAR_OVERRUN: Data 0x0000, echoes the request
+ * DIAGNOSTIC_BUS_MESSAGE_COUNT to DIAGNOSTIC_BUS_OVERRUN_COUNT: Data 0x0000, the response carries the counter in the data field
+ * Frames for other boards are dropped after their header, so the CRC is only checked, and bus communication errors are
+ * only counted, on frames addressed to this board. A frame left without a response (broadcast, group or discovery
+ * frames no board answers) is counted in DIAGNOSTIC_SLAVE_NO_RESPONSE_COUNT when the next frame arrives.
+ * Messages are never NAKed and the board is never busy, those counters always read 0.
+ */
+#define MB_DIAGNOSTICS 0x08
+
+typedef enum diagnostic_e
+{
+	DIAGNOSTIC_RETURN_QUERY_DATA = 0x00,
+	DIAGNOSTIC_RESTART_COMMS = 0x01,
+	DIAGNOSTIC_CLEAR_COUNTERS = 0x0A,
+	DIAGNOSTIC_BUS_MESSAGE_COUNT = 0x0B, // Every frame seen on the bus
+	DIAGNOSTIC_BUS_COMM_ERROR_COUNT, // CRC errors
+	DIAGNOSTIC_BUS_EXCEPTION_COUNT, // Exception responses sent
+	DIAGNOSTIC_SLAVE_MESSAGE_COUNT, // Frames addressed to this board, including broadcast and group frames
+	DIAGNOSTIC_SLAVE_NO_RESPONSE_COUNT,
+	DIAGNOSTIC_SLAVE_NAK_COUNT,
+	DIAGNOSTIC_SLAVE_BUSY_COUNT,
+	DIAGNOSTIC_BUS_OVERRUN_COUNT, // Characters lost to receiver overruns
+	DIAGNOSTIC_CLEAR_OVERRUN = 0x14
+}diagnostic_t;
+
+/*
+ * Read file record (function code 0x14), for bulk reads of the logs kept on the board
+ * Request: ID, 0x14, byte count, then per sub-request: reference type (MB_FILE_REFERENCE_TYPE), file number,
+ * 			record number and record length (2 bytes each), CRC
+ * Every record is one 16 bit register, all the sub-requests of a frame share the MB_FILE_RESPONSE_MAX byte response
+ */
+#define MB_READ_FILE_RECORD 0x14
+#define MB_FILE_REFERENCE_TYPE 0x06
+#define MB_FILE_RESPONSE_MAX 0xF5
+
+typedef enum modbus_file_e
+{
+	MB_FILE_TRACE = 0x0001, // Transaction trace, see trace.h
+	MB_FILE_JOURNAL = 0x0002, // Event journal, see journal.h
+	MB_FILE_PROFILE = 0x0003 // PC samples, see profile.h
+}modbus_file_t;
+
+#ifdef MB_MASTER
+/*
+ * Master transaction queue
+ * Requests are queued with modbus_queue() and issued by monitor_modbus() one after the other, each as soon as the
+ * previous response has ended and the 3.5 character inter-frame gap has passed.
+ * A missing, corrupt or mismatched response is retried up to retries times, an exception response is not.
+ * The callback runs from monitor_modbus() with MB_SUCCESS, the exception code or the error of the last attempt.
+ * For 0x03 / 0x04 the registers read are stored in data, for 0x10 data holds the values to write.
+ * data must stay valid until the callback has run, it is left untouched by a failed read.
+ * A request sent to MB_BROADCAST_ADDRESS completes once it has been transmitted.
+ * modbus_schedule() places a transaction in the schedule table, it is queued every interval ms
+ * and is not queued again while a previous copy is still waiting.
+ */
+#define MODBUS_QUEUE_SIZE 8
+#define MODBUS_SCHEDULE_SIZE 8
+
+typedef void (*modbus_callback_t)(uint8_t tag, int8_t status);
+
+typedef struct modbus_transaction_s
+{
+	uint8_t id;
+	uint8_t function_code; // 0x03, 0x04 or 0x10
+	uint16_t address;
+	uint16_t quantity;
+	uint16_t *data;
+	uint16_t timeout; // ms allowed for the response
+	uint8_t retries;
+	uint8_t tag; // Handed back to the callback
+	modbus_callback_t callback; // May be NULL
+}modbus_transaction_t;
+#endif
+
+
 
 
 // Modbus Master Functions --------------------------------------------------------------------
@@ -41,22 +232,39 @@ typedef enum baud_rate_e
 int8_t set_transmit_buffer(uint8_t index, uint16_t value);
 uint16_t get_response_buffer(uint8_t index);
 int8_t read_holding_registers(uint16_t read_address, uint16_t read_quantity, uint8_t id);
+int8_t read_input_registers(uint16_t read_address, uint16_t read_quantity, uint8_t id);
 int8_t write_multiple_registers(uint16_t write_address, uint16_t write_quantity, uint8_t id);
 int8_t modbus_mic(uint8_t id, uint8_t function_code, uint8_t size);
 uint8_t response_received();
+uint8_t modbus_master_idle();
 void set_response_interval(uint32_t delay);
 uint32_t get_response_interval();
+int8_t modbus_master_set_baud_rate(uint32_t baud_rate);
+int8_t modbus_queue(const modbus_transaction_t *transaction);
+uint8_t modbus_queue_count();
+int8_t modbus_schedule(uint8_t slot, const modbus_transaction_t *transaction, uint16_t interval);
+void modbus_unschedule(uint8_t slot);
 #endif
 
 // Modbus Slave Functions ---------------------------------------------------------------------
 #ifdef MB_SLAVE
 int8_t return_holding_registers(uint8_t *tx_len);
+int8_t return_input_registers(uint8_t *tx_len);
 int8_t edit_multiple_registers(uint8_t *tx_len);
 int8_t modbus_exception(int8_t exception_code);
+uint8_t modbus_address_match(uint8_t address);
+uint8_t modbus_broadcast_match(uint8_t address);
+uint8_t modbus_own_id();
+uint8_t modbus_rx_port();
+void modbus_restore_address();
+int8_t modbus_enumerate(uint8_t *tx_len);
+int8_t modbus_diagnostics(uint8_t *tx_len);
+int8_t modbus_read_file_record(uint8_t *tx_len);
 #endif
 
 // General Modbus Functions -------------------------------------------------------------------
 int8_t modbus_send(uint8_t size);
+int8_t modbus_send_delayed(uint8_t size, uint32_t delay);
 uint8_t modbus_rx();
 int8_t modbus_set_rx();
 void store_rx_buffer();
@@ -66,12 +274,26 @@ int8_t modbus_reset();
 // General Modbus Control Functions ------------------------------------------------------------
 int8_t modbus_startup();
 int8_t modbus_shutdown();
+uint8_t modbus_work_pending();
+void modbus_irq_handler(UART_HandleTypeDef *huart);
+void modbus_count_irq(UART_HandleTypeDef *huart);
+uint8_t modbus_bus_idle();
 int8_t modbus_change_baud_rate();
-int8_t modbus_set_baud_rate(uint8_t baud_rate);
-int8_t modbus_get_baud_rate(uint8_t *baud_rate);
+int8_t modbus_clock_changed();
+uint32_t modbus_get_actual_baud_rate();
+int32_t modbus_get_baud_rate_error();
+int8_t modbus_set_baud_rate(uint32_t baud_rate);
+int8_t modbus_get_baud_rate(uint32_t *baud_rate);
+int8_t modbus_restore_baud_rate();
+int8_t modbus_auto_baud_start();
+uint32_t modbus_get_table_baud_rate(uint8_t baud_rate);
+uint8_t modbus_port_role(uint8_t port);
+void modbus_restore_port_config();
+int8_t modbus_store_port_config();
 
 // Low Level Functions -------------------------------------------------------------------------
 uint8_t get_rx_buffer(uint8_t index);
+uint16_t crc_16(uint8_t *data, uint8_t size);
 int8_t handle_modbus_error(int8_t error_code);
 
 #endif /* INC_MODBUS_H_ */
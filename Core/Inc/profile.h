@@ -0,0 +1,51 @@
+/*
+ * profile.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: Victor Kalenda
+ */
+
+#include <stdint.h>
+
+#ifndef INC_PROFILE_H_
+#define INC_PROFILE_H_
+
+/*
+ * PC sampling profiler
+ * While PROFILE_CONTROL is PROFILE_RUN, every SysTick interrupt (1ms) takes the PC it interrupted from the exception
+ * frame and counts it in a table of PROFILE_SIZE addresses. Writing PROFILE_RUN clears the table and starts a new
+ * profile, writing PROFILE_STOP freezes it for reading. SysTick is suspended in Stop mode, time spent there is not
+ * sampled.
+ * A SysTick that is masked is taken when PRIMASK is cleared, and is counted against the instruction after the
+ * __enable_irq(). idle_enter() sleeps with PRIMASK set, so a tick that fell due in Sleep is flagged by idle_sleep()
+ * and counted as an idle sample instead of against main(). Other masked sections still show up after their end.
+ * The table is read as file MB_FILE_PROFILE with function code 0x14 (read file record), one register per record number:
+ * [0..1]   Samples taken, idle samples included, high word first
+ * [2..3]   Samples lost because their address did not fit in the table, high word first
+ * [4..5]   Idle samples, ticks that fell due in Sleep, high word first
+ * [6]      PROFILE_SIZE
+ * [7]      PROFILE_ENTRY_SIZE
+ * [8..]    PROFILE_SIZE entries in no particular order, PROFILE_ENTRY_SIZE registers each:
+ *          [0..1] PC, high word first
+ *          [2]    Samples, saturates at 0xFFFF, 0 for an unused entry
+ * profile.py maps the addresses to the functions of PowerManagementBoard.elf.
+ */
+typedef enum profile_control_e
+{
+	PROFILE_STOP,
+	PROFILE_RUN
+}profile_control_t;
+
+#define PROFILE_SIZE 256
+#define PROFILE_PROBES 8 // Entries searched for an address before its sample is lost
+#define PROFILE_ENTRY_SIZE 3
+#define PROFILE_FILE_HEADER 8
+#define PROFILE_FILE_SIZE (PROFILE_FILE_HEADER + PROFILE_SIZE * PROFILE_ENTRY_SIZE)
+
+void profile_start();
+void profile_stop();
+void profile_sample(uint32_t pc);
+void profile_idle();
+int8_t profile_read(uint16_t record, uint16_t length, uint8_t *data);
+
+#endif /* INC_PROFILE_H_ */
@@ -0,0 +1,36 @@
+/*
+ * ram.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: Victor Kalenda
+ */
+
+#include <stdint.h>
+
+#ifndef INC_RAM_H_
+#define INC_RAM_H_
+
+/*
+ * RAM budget
+ * Reset_Handler (startup_stm32c071cbtx.s) paints every word from _end, above .bss and the other static sections, up
+ * to the top of the stack with RAM_PAINT before anything runs. The stack grows down into the painted words, so
+ * the lowest word that lost its paint is the deepest the stack has reached since reset. ram_service() looks for
+ * it RAM_SCAN_WORDS words per call from the bottom up, which keeps each super-loop iteration short.
+ * The block is read from RAM_START in input registers, all sizes in bytes:
+ * [0]      RAM size
+ * [1]      .data
+ * [2]      .bss
+ * [3]      Other static sections between .bss and _end
+ * [4]      _Min_Stack_Size, the stack the linker script reserves
+ * [5]      Deepest stack use since reset
+ * [6]      Headroom, the RAM between _end and the deepest stack use that was never written
+ * No heap is used, malloc() would take its memory from the painted region and count as stack.
+ */
+#define RAM_PAINT 0xA5A5A5A5 // Keep in step with Reset_Handler
+#define RAM_SCAN_WORDS 32
+#define RAM_BLOCK_SIZE 7
+
+void ram_service();
+void ram_export(uint16_t *registers);
+
+#endif /* INC_RAM_H_ */
@@ -0,0 +1,46 @@
+/*
+ * sync.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: Victor Kalenda
+ */
+
+#include <stdint.h>
+
+#ifndef INC_SYNC_H_
+#define INC_SYNC_H_
+
+/*
+ * Bus time synchronisation and scheduled relay switching
+ * The host broadcasts an epoch (SYNC_EPOCH_HIGH / SYNC_EPOCH_LOW), the bus time in microseconds at the end of that frame.
+ * Every board receives the end of the frame at the same instant, so each records the offset between the epoch and
+ * its own TIM2 count, and a relay state written with an activation time (SCHEDULE_TIME_HIGH / SCHEDULE_TIME_LOW)
+ * is switched from the TIM2 compare interrupt at that bus time on every board.
+ * The HSI is only accurate to about 1%, so the epoch should be sent shortly before the activation time,
+ * ideally in the same frame (SYNC_EPOCH_HIGH through SCHEDULE_TIME_LOW are contiguous).
+ */
+typedef enum sync_state_e
+{
+	SYNC_STATE_FREE, // No epoch received or the epoch has expired
+	SYNC_STATE_LOCKED,
+	SYNC_STATE_SCHEDULED // A relay change is waiting for its activation time
+}sync_state_t;
+
+#define SYNC_HOLD_TIME 60000 // ms an epoch is trusted for, TIM2 halts in Stop mode so the timer also keeps the core out of Stop
+
+typedef struct sync_stats_s
+{
+	uint16_t skew; // us between the activation time and the relay outputs switching
+	uint16_t skew_max;
+}sync_stats_t;
+
+extern sync_stats_t sync_stats;
+
+void sync_set_epoch(uint32_t bus_time, uint32_t local_time);
+uint8_t sync_get_state();
+uint32_t sync_bus_time();
+void sync_schedule(uint32_t bus_time, uint8_t gpio_state);
+void sync_cancel();
+uint8_t sync_fired(uint8_t *gpio_state);
+
+#endif /* INC_SYNC_H_ */
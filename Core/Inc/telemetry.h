@@ -0,0 +1,60 @@
+/*
+ * telemetry.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: Victor Kalenda
+ */
+
+#include <stdint.h>
+
+#ifndef INC_TELEMETRY_H_
+#define INC_TELEMETRY_H_
+
+/*
+ * Telemetry stream
+ * While USART2 is not used for Modbus (MB2_ROLE = MODBUS_ROLE_DISABLED) it can push unsolicited records to a data
+ * logger at MB2_BAUD_RATE, sent by DMA so the super-loop only spends the time to fill one record.
+ * TELEMETRY_MODE selects when a record is sent, TELEMETRY_INTERVAL is the period in ms.
+ * A period that passes with its record still waiting for the line counts in TELEMETRY_OVERRUNS, the waiting
+ * record is filled when the line frees up, so the logger always sees the latest state.
+ * The core is kept out of Stop and at full clock while streaming.
+ *
+ * Record layout, multi byte fields are big endian like Modbus registers:
+ * [0]      TELEMETRY_SYNC
+ * [1]      Record length including the sync byte and CRC (TELEMETRY_RECORD_SIZE)
+ * [2..3]   Sequence number, a gap means records were lost on the line
+ * [4..7]   TIM2 time of the record in us
+ * [8..9]   GPIO_READ
+ * [10..11] GPIO_WRITE
+ * [12..15] TIM2 time of the last input edge in us
+ * [16..17] MB_ERRORS
+ * [18..19] USART1 overruns, low 16 bits
+ * [20..21] Super-loop iterations since the previous record
+ * [22..23] Modbus CRC-16 of bytes 0 to 21, low byte first
+ */
+typedef enum telemetry_mode_e
+{
+	TELEMETRY_OFF = 0x00,
+	TELEMETRY_PERIODIC = 0x01, // Every TELEMETRY_INTERVAL ms
+	TELEMETRY_ON_CHANGE = 0x02, // On an input edge or a change of GPIO_READ / GPIO_WRITE
+	TELEMETRY_MODE_MASK = 0x03
+}telemetry_mode_t;
+
+#define TELEMETRY_SYNC 0xA5
+#define TELEMETRY_RECORD_SIZE 24
+
+typedef struct telemetry_stats_s
+{
+	uint32_t records;
+	uint16_t overruns;
+}telemetry_stats_t;
+
+extern telemetry_stats_t telemetry_stats;
+
+void telemetry_restore();
+void telemetry_store();
+void telemetry_service();
+void telemetry_edge();
+uint8_t telemetry_idle();
+
+#endif /* INC_TELEMETRY_H_ */
@@ -0,0 +1,60 @@
+/*
+ * timer.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: Victor Kalenda
+ */
+
+#include <stdint.h>
+
+#ifndef INC_TIMER_H_
+#define INC_TIMER_H_
+
+/*
+ * Software timer service
+ * Every protocol and safety timeout in the firmware owns one slot in the timer table.
+ * TIM2 free runs as a 32 bit microsecond counter and a single compare channel (CC1) is
+ * programmed for the earliest armed deadline, so arming or cancelling a timer is O(1).
+ * On expiry the timer's event flag is raised and its callback (if any) runs in interrupt context.
+ */
+
+#define TIMER_TICKS_PER_MS 1000U
+
+typedef enum timer_id_e
+{
+	TIMER_WDG,
+	TIMER_RELAY_SEQUENCE,
+	TIMER_MB_TX,
+	TIMER_MB_CHUNK,
+	TIMER_MB_TURNAROUND,
+	TIMER_MB_RX,
+	TIMER_MB_BAUD_PROBATION,
+	TIMER_CLOCK_IDLE,
+	TIMER_RELAY_SCHEDULE,
+	TIMER_SYNC_HOLD,
+	TIMER_MB2_TX,
+	TIMER_MB2_CHUNK,
+	TIMER_MB2_TURNAROUND,
+	TIMER_MB2_RX,
+	TIMER_MB_SCHEDULE,
+	TIMER_TELEMETRY,
+	TIMER_JOURNAL,
+	NUM_TIMERS
+}timer_id_t;
+
+typedef void (*timer_callback_t)(void);
+
+void timer_init();
+void timer_start(timer_id_t id, uint32_t ms, timer_callback_t callback);
+void timer_start_us(timer_id_t id, uint32_t us, timer_callback_t callback);
+void timer_stop(timer_id_t id);
+uint8_t timer_running(timer_id_t id);
+uint8_t timer_expired(timer_id_t id);
+uint8_t timer_next_expiry(uint32_t *us);
+uint8_t timer_pending();
+void timer_set_clock(uint32_t timer_clock);
+void timer_advance(uint32_t us);
+uint32_t timer_now();
+void timer_irq_handler();
+
+#endif /* INC_TIMER_H_ */
@@ -0,0 +1,61 @@
+/*
+ * trace.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: Victor Kalenda
+ */
+
+#include <stdint.h>
+
+#ifndef INC_TRACE_H_
+#define INC_TRACE_H_
+
+/*
+ * Transaction trace
+ * The last TRACE_SIZE frames addressed to this board are kept in RAM, whether they were answered or not, along with
+ * frames that failed their CRC. The trace is read as file MB_FILE_TRACE with function code 0x14 (read file record),
+ * where every record number is one 16 bit register:
+ * [0..1]   Entries traced since power up, high word first
+ * [2]      Entries held, at most TRACE_SIZE
+ * [3]      TRACE_ENTRY_SIZE
+ * [4..]    The entries held, oldest first, TRACE_ENTRY_SIZE registers each:
+ *          [0]    Sequence number, the low word of the entry count when it was traced
+ *          [1..2] TIM2 time at the end of the frame in us, high word first
+ *          [3]    Slave ID (high byte), function code (low byte)
+ *          [4]    Bytes 2 and 3 of the frame, the register address for 0x03 / 0x04 / 0x10
+ *          [5]    Bytes 4 and 5 of the frame, the quantity for 0x03 / 0x04 / 0x10
+ *          [6]    Port (high byte), trace_result_t or the Modbus exception code returned (low byte)
+ *          [7]    Response time in us from the end of the frame to the end of the response, up to 0xFFFE,
+ *                 0xFFFF if no response left
+ * An entry is traced once its response has left, or when the next frame arrives if it was not answered, so a read
+ * always finds the frames before it. Sequence numbers let the host join a trace read over several frames.
+ */
+#define TRACE_SIZE 64
+#define TRACE_ENTRY_SIZE 8
+#define TRACE_FILE_HEADER 4
+#define TRACE_FILE_SIZE (TRACE_FILE_HEADER + TRACE_SIZE * TRACE_ENTRY_SIZE)
+
+typedef enum trace_result_e
+{
+	TRACE_ANSWERED = 0x00,
+	// 0x01 to 0x0B: Modbus exception code returned
+	TRACE_NO_RESPONSE = 0xFE,
+	TRACE_CRC_ERROR = 0xFF
+}trace_result_t;
+
+typedef struct trace_entry_s
+{
+	uint32_t time;
+	uint8_t port;
+	uint8_t id;
+	uint8_t function_code;
+	uint8_t result;
+	uint16_t address;
+	uint16_t quantity;
+	uint16_t response_time;
+}trace_entry_t;
+
+void trace_record(const trace_entry_t *entry);
+int8_t trace_read(uint16_t record, uint16_t length, uint8_t *data);
+
+#endif /* INC_TRACE_H_ */
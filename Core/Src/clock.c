@@ -0,0 +1,149 @@
+/*
+ * clock.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: Victor Kalenda
+ *
+ */
+
+#include "clock.h"
+#include "timer.h"
+#include "modbus.h"
+#include "main.h"
+#include <stdint.h>
+
+typedef struct clock_profile_config_s
+{
+	uint32_t sysclk_source;
+	uint32_t hsi_div;
+	uint32_t flash_latency;
+}clock_profile_config_t;
+
+/*
+ * The HSI divider is kept at /4 whenever the HSI is not the system clock,
+ * so the HSISYS clock the core wakes up on from Stop mode never exceeds the retained flash latency
+ */
+static const clock_profile_config_t clock_profiles[NUM_CLOCK_PROFILES] = {
+	{RCC_SYSCLKSOURCE_HSE, RCC_HSI_DIV4, FLASH_LATENCY_0}, // CLOCK_PROFILE_HSE_8MHZ
+	{RCC_SYSCLKSOURCE_HSI, RCC_HSI_DIV2, FLASH_LATENCY_0}, // CLOCK_PROFILE_HSI_24MHZ
+	{RCC_SYSCLKSOURCE_HSI, RCC_HSI_DIV1, FLASH_LATENCY_1}  // CLOCK_PROFILE_HSI_48MHZ
+};
+
+static uint8_t current_profile = CLOCK_PROFILE_HSE_8MHZ;
+static uint8_t selected_profile = CLOCK_PROFILE_HSE_8MHZ; // Last profile asked of clock_service()
+
+// Private Functions
+int8_t clock_apply(uint8_t profile);
+
+int8_t clock_set_profile(uint8_t profile)
+{
+	if(profile >= NUM_CLOCK_PROFILES)
+	{
+		return HAL_ERROR;
+	}
+	if(profile == current_profile)
+	{
+		return HAL_OK;
+	}
+	return clock_apply(profile);
+}
+
+uint8_t clock_get_profile()
+{
+	return current_profile;
+}
+
+/*
+ * Re-apply the current profile after waking from Stop mode, where the core resumes on HSISYS with the HSE off
+ */
+int8_t clock_restore()
+{
+	return clock_apply(current_profile);
+}
+
+/*
+ * Run the selected profile while the bus is active, and drop to the low power profile
+ * once the bus has been idle for CLOCK_IDLE_TIMEOUT when scaling is enabled
+ */
+int8_t clock_service(uint8_t profile, uint8_t scaling, uint8_t bus_idle)
+{
+	selected_profile = profile;
+	if(scaling && bus_idle)
+	{
+		if(current_profile != CLOCK_PROFILE_LOW_POWER && !timer_running(TIMER_CLOCK_IDLE))
+		{
+			if(timer_expired(TIMER_CLOCK_IDLE))
+			{
+				return clock_set_profile(CLOCK_PROFILE_LOW_POWER);
+			}
+			timer_start(TIMER_CLOCK_IDLE, CLOCK_IDLE_TIMEOUT, NULL);
+		}
+		return HAL_OK;
+	}
+
+	// A frame is arriving or scaling is off, run at the selected rate
+	timer_stop(TIMER_CLOCK_IDLE);
+	return clock_set_profile(profile);
+}
+
+/*
+ * Return to the selected profile before a transmission clock_service() has not seen yet
+ * USART2 follows PCLK, so the clock must not change under a frame it is sending or waiting for
+ */
+int8_t clock_wake()
+{
+	timer_stop(TIMER_CLOCK_IDLE);
+	return clock_set_profile(selected_profile);
+}
+
+// Private Functions ---------------------------------------------------------------------------
+
+int8_t clock_apply(uint8_t profile)
+{
+	RCC_OscInitTypeDef RCC_OscInitStruct = {0};
+	RCC_ClkInitTypeDef RCC_ClkInitStruct = {0};
+	const clock_profile_config_t *config = &clock_profiles[profile];
+
+	// One wait state is valid at every frequency, hold it until HAL_RCC_ClockConfig settles the final latency
+	__HAL_FLASH_SET_LATENCY(FLASH_LATENCY_1);
+	while(__HAL_FLASH_GET_LATENCY() != FLASH_LATENCY_1);
+
+	RCC_OscInitStruct.OscillatorType = RCC_OSCILLATORTYPE_HSI|RCC_OSCILLATORTYPE_HSE;
+	RCC_OscInitStruct.HSEState = RCC_HSE_ON;
+	RCC_OscInitStruct.HSIState = RCC_HSI_ON;
+	RCC_OscInitStruct.HSIDiv = config->hsi_div;
+	RCC_OscInitStruct.HSICalibrationValue = RCC_HSICALIBRATION_DEFAULT;
+	int8_t status = HAL_RCC_OscConfig(&RCC_OscInitStruct);
+	if(status != HAL_OK)
+	{
+		return status;
+	}
+
+	RCC_ClkInitStruct.ClockType = RCC_CLOCKTYPE_HCLK|RCC_CLOCKTYPE_SYSCLK
+	                            |RCC_CLOCKTYPE_PCLK1;
+	RCC_ClkInitStruct.SYSCLKSource = config->sysclk_source;
+	RCC_ClkInitStruct.SYSCLKDivider = RCC_SYSCLK_DIV1;
+	RCC_ClkInitStruct.AHBCLKDivider = RCC_HCLK_DIV1;
+	RCC_ClkInitStruct.APB1CLKDivider = RCC_APB1_DIV1;
+
+	// Also updates SysTick for the new HCLK
+	status = HAL_RCC_ClockConfig(&RCC_ClkInitStruct, config->flash_latency);
+	if(status != HAL_OK)
+	{
+		return status;
+	}
+
+	// The crystal is only needed by its own profile
+	if(config->sysclk_source != RCC_SYSCLKSOURCE_HSE)
+	{
+		RCC_OscInitStruct.OscillatorType = RCC_OSCILLATORTYPE_HSE;
+		RCC_OscInitStruct.HSEState = RCC_HSE_OFF;
+		HAL_RCC_OscConfig(&RCC_OscInitStruct);
+	}
+
+	current_profile = profile;
+
+	// Keep the timer service counting in microseconds and the USART on its configured baud rate
+	timer_set_clock(HAL_RCC_GetPCLK1Freq());
+	return modbus_clock_changed();
+}
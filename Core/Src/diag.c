@@ -0,0 +1,65 @@
+/*
+ * diag.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: Victor Kalenda
+ *
+ */
+
+#include "diag.h"
+#include "error_codes.h"
+#include "stm32c0xx_hal.h"
+#include <stdint.h>
+
+static volatile uint32_t error_count[NUM_ERROR_CODES];
+static uint32_t error_snapshot[NUM_ERROR_CODES]; // Counts at the last ERROR_SNAPSHOT write
+
+/*
+ * Count one occurrence of error_code, codes outside of error_codes.h are ignored
+ */
+void diag_count(int8_t error_code)
+{
+	if(error_code < 1 || error_code > NUM_ERROR_CODES)
+	{
+		return;
+	}
+	// The Cortex-M0+ has no exclusive access instructions, so the read-modify-write is made atomic by masking interrupts
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	if(error_count[error_code - 1] < 0xFFFFFFFF)
+	{
+		error_count[error_code - 1]++;
+	}
+
+	__set_PRIMASK(primask);
+}
+
+/*
+ * Move the counters into the snapshot and start counting from zero
+ */
+void diag_snapshot()
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	for(uint8_t i = 0; i < NUM_ERROR_CODES; i++)
+	{
+		error_snapshot[i] = error_count[i];
+		error_count[i] = 0;
+	}
+
+	__set_PRIMASK(primask);
+}
+
+/*
+ * Copy the snapshot into the register block starting at registers, high word first
+ */
+void diag_export(uint16_t *registers)
+{
+	for(uint8_t i = 0; i < NUM_ERROR_CODES; i++)
+	{
+		registers[2 * i] = (error_snapshot[i] >> 16) & 0xFFFF;
+		registers[2 * i + 1] = error_snapshot[i] & 0xFFFF;
+	}
+}
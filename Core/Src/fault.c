@@ -0,0 +1,118 @@
+/*
+ * fault.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: Victor Kalenda
+ *
+ */
+
+#include "fault.h"
+#include "modbus.h"
+#include "stm32c0xx_hal.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#define FAULT_RECORD_CRC_SIZE offsetof(fault_record_t, crc)
+#define FAULT_XPSR_ALIGN (1U << 9) // The core added a word to align the frame to 8 bytes
+
+extern uint32_t _estack;
+
+static fault_record_t fault_record __attribute__((section(".noinit")));
+
+// Private Functions
+uint8_t fault_valid();
+void fault_seal();
+void fault_put(uint16_t *registers, uint32_t value);
+
+/*
+ * Called by HardFault_Capture_Handler with the exception frame and the EXC_RETURN value of the fault
+ */
+void fault_capture(const uint32_t *frame, uint32_t exc_return)
+{
+	uint32_t count = fault_valid() ? fault_record.count + 1 : 1;
+	fault_record.magic = FAULT_MAGIC;
+	fault_record.count = count;
+	fault_record.tick = HAL_GetTick();
+	fault_record.exc_return = exc_return;
+	fault_record.reported = 0;
+
+	if(((uint32_t)frame & 0x3) == 0 && (uint32_t)frame >= SRAM_BASE && (uint32_t)frame + NUM_FAULT_FRAME_WORDS * 4 <= (uint32_t)&_estack)
+	{
+		for(uint8_t i = 0; i < NUM_FAULT_FRAME_WORDS; i++)
+		{
+			fault_record.frame[i] = frame[i];
+		}
+		fault_record.sp = (uint32_t)frame + NUM_FAULT_FRAME_WORDS * 4 + ((frame[FAULT_XPSR] & FAULT_XPSR_ALIGN) ? 4 : 0);
+		fault_record.source = frame[FAULT_XPSR] & 0x3F;
+	}
+	else
+	{
+		for(uint8_t i = 0; i < NUM_FAULT_FRAME_WORDS; i++)
+		{
+			fault_record.frame[i] = 0;
+		}
+		fault_record.sp = (uint32_t)frame;
+		fault_record.source = 0;
+	}
+	fault_seal();
+}
+
+/*
+ * Return the fault that reset the board the first time it is asked for, NULL if there is none
+ */
+const fault_record_t *fault_unreported()
+{
+	if(!fault_valid() || fault_record.reported)
+	{
+		return NULL;
+	}
+	fault_record.reported = 1;
+	fault_seal();
+	return &fault_record;
+}
+
+/*
+ * Copy the last fault into the register block starting at registers, see fault.h for the layout
+ */
+void fault_export(uint16_t *registers)
+{
+	if(!fault_valid())
+	{
+		for(uint8_t i = 0; i < FAULT_BLOCK_SIZE; i++)
+		{
+			registers[i] = 0;
+		}
+		return;
+	}
+	fault_put(&registers[0], fault_record.count);
+	registers[2] = fault_record.source;
+	fault_put(&registers[3], fault_record.tick);
+	fault_put(&registers[5], fault_record.frame[FAULT_PC]);
+	fault_put(&registers[7], fault_record.frame[FAULT_LR]);
+	fault_put(&registers[9], fault_record.frame[FAULT_XPSR]);
+	fault_put(&registers[11], fault_record.frame[FAULT_R0]);
+	fault_put(&registers[13], fault_record.frame[FAULT_R1]);
+	fault_put(&registers[15], fault_record.frame[FAULT_R2]);
+	fault_put(&registers[17], fault_record.frame[FAULT_R3]);
+	fault_put(&registers[19], fault_record.frame[FAULT_R12]);
+	fault_put(&registers[21], fault_record.sp);
+	fault_put(&registers[23], fault_record.exc_return);
+}
+
+// Private Functions ---------------------------------------------------------------------------
+
+uint8_t fault_valid()
+{
+	return (fault_record.magic == FAULT_MAGIC) && (crc_16((uint8_t *)&fault_record, FAULT_RECORD_CRC_SIZE) == fault_record.crc);
+}
+
+void fault_seal()
+{
+	fault_record.crc = crc_16((uint8_t *)&fault_record, FAULT_RECORD_CRC_SIZE);
+}
+
+void fault_put(uint16_t *registers, uint32_t value)
+{
+	registers[0] = (value >> 16) & 0xFFFF;
+	registers[1] = value & 0xFFFF;
+}
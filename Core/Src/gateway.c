@@ -0,0 +1,153 @@
+/*
+ * gateway.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: Victor Kalenda
+ *
+ */
+
+#include "gateway.h"
+#include "modbus.h"
+#include "main.h"
+#include "ee.h"
+#include <stdint.h>
+
+#ifdef MB_MASTER
+
+#define entry_register(entry, reg) holding_register_database[(reg) + (entry) * GATEWAY_ENTRY_SIZE]
+
+static modbus_transaction_t applied[NUM_GATEWAY_ENTRIES]; // Configuration each schedule slot was last loaded with
+static uint16_t applied_interval[NUM_GATEWAY_ENTRIES];
+
+// External Variables
+extern uint16_t holding_register_database[];
+extern uint16_t input_register_database[];
+extern ee_storage_t ee;
+
+// Private Functions
+void gateway_complete(uint8_t tag, int8_t status);
+
+/*
+ * Load the poll table from the emulated EEPROM, an erased or invalid entry stays unused
+ */
+void gateway_restore()
+{
+	if(ee.gateway_timeout >= 10 && ee.gateway_timeout <= 1000)
+	{
+		holding_register_database[GATEWAY_TIMEOUT] = ee.gateway_timeout;
+	}
+	for(uint8_t i = 0; i < NUM_GATEWAY_ENTRIES; i++)
+	{
+		if(ee.gateway_id[i] >= 1 && ee.gateway_id[i] <= MB_MAX_SLAVE_ID &&
+		  (ee.gateway_function[i] == 0x03 || ee.gateway_function[i] == 0x04) &&
+		   ee.gateway_count[i] >= 1 && ee.gateway_count[i] <= GATEWAY_MIRROR_SIZE && ee.gateway_interval[i] >= 10)
+		{
+			entry_register(i, GATEWAY_1_ID) = ee.gateway_id[i];
+			entry_register(i, GATEWAY_1_FUNCTION) = ee.gateway_function[i];
+			entry_register(i, GATEWAY_1_ADDRESS) = ee.gateway_address[i];
+			entry_register(i, GATEWAY_1_COUNT) = ee.gateway_count[i];
+			entry_register(i, GATEWAY_1_INTERVAL) = ee.gateway_interval[i];
+		}
+	}
+}
+
+void gateway_store()
+{
+	uint8_t changed = 0;
+	if(ee.gateway_timeout != holding_register_database[GATEWAY_TIMEOUT])
+	{
+		ee.gateway_timeout = holding_register_database[GATEWAY_TIMEOUT];
+		changed = 1;
+	}
+	for(uint8_t i = 0; i < NUM_GATEWAY_ENTRIES; i++)
+	{
+		if(ee.gateway_id[i] != entry_register(i, GATEWAY_1_ID) ||
+		   ee.gateway_function[i] != entry_register(i, GATEWAY_1_FUNCTION) ||
+		   ee.gateway_address[i] != entry_register(i, GATEWAY_1_ADDRESS) ||
+		   ee.gateway_count[i] != entry_register(i, GATEWAY_1_COUNT) ||
+		   ee.gateway_interval[i] != entry_register(i, GATEWAY_1_INTERVAL))
+		{
+			ee.gateway_id[i] = entry_register(i, GATEWAY_1_ID);
+			ee.gateway_function[i] = entry_register(i, GATEWAY_1_FUNCTION);
+			ee.gateway_address[i] = entry_register(i, GATEWAY_1_ADDRESS);
+			ee.gateway_count[i] = entry_register(i, GATEWAY_1_COUNT);
+			ee.gateway_interval[i] = entry_register(i, GATEWAY_1_INTERVAL);
+			changed = 1;
+		}
+	}
+	if(changed)
+	{
+		EE_Write();
+	}
+}
+
+/*
+ * Keep the master schedule table in step with the GATEWAY registers, entry n polls from schedule slot n - 1
+ */
+void gateway_service()
+{
+	// Nothing is polled while USART2 is a slave port or disabled (MB2_ROLE), the mirror is stale
+	if(modbus_port_role(MODBUS_MASTER_PORT) != MODBUS_ROLE_MASTER)
+	{
+		input_register_database[GATEWAY_STATUS] = 0;
+	}
+
+	for(uint8_t entry = 0; entry < NUM_GATEWAY_ENTRIES; entry++)
+	{
+		modbus_transaction_t transaction = {
+			.id = entry_register(entry, GATEWAY_1_ID),
+			.function_code = entry_register(entry, GATEWAY_1_FUNCTION),
+			.address = entry_register(entry, GATEWAY_1_ADDRESS),
+			.quantity = entry_register(entry, GATEWAY_1_COUNT),
+			.data = &input_register_database[GATEWAY_MIRROR_START + entry * GATEWAY_MIRROR_SIZE],
+			.timeout = holding_register_database[GATEWAY_TIMEOUT],
+			.retries = holding_register_database[MB_TRANSMIT_RETRIES],
+			.tag = entry,
+			.callback = gateway_complete
+		};
+		uint16_t interval = entry_register(entry, GATEWAY_1_INTERVAL);
+		if(transaction.id == applied[entry].id && transaction.function_code == applied[entry].function_code &&
+		   transaction.address == applied[entry].address && transaction.quantity == applied[entry].quantity &&
+		   transaction.timeout == applied[entry].timeout && transaction.retries == applied[entry].retries &&
+		   interval == applied_interval[entry])
+		{
+			continue;
+		}
+		applied[entry] = transaction;
+		applied_interval[entry] = interval;
+
+		if(transaction.id == 0)
+		{
+			modbus_unschedule(entry);
+			input_register_database[GATEWAY_STATUS] &= ~(1U << entry);
+		}
+		else
+		{
+			modbus_schedule(entry, &transaction, interval);
+		}
+	}
+}
+
+// Private Functions ---------------------------------------------------------------------------
+
+/*
+ * Poll completion, runs from monitor_modbus(), the queue has already stored the registers read on success
+ */
+void gateway_complete(uint8_t tag, int8_t status)
+{
+	if(status == MB_SUCCESS)
+	{
+		input_register_database[GATEWAY_STATUS] |= 1U << tag;
+	}
+	else
+	{
+		// The mirror keeps the last good values, the status bit tells the host they are stale
+		input_register_database[GATEWAY_STATUS] &= ~(1U << tag);
+		if(input_register_database[GATEWAY_ERRORS] < 0xFFFF)
+		{
+			input_register_database[GATEWAY_ERRORS]++;
+		}
+	}
+}
+
+#endif // MB_MASTER
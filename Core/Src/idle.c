@@ -0,0 +1,251 @@
+/*
+ * idle.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: Victor Kalenda
+ *
+ */
+
+#include "idle.h"
+#include "timer.h"
+#include "clock.h"
+#include "main.h"
+#include "profile.h"
+#include <stdint.h>
+
+#define IDLE_RTC_PREDIV_A 7 // LSI / 8, a 4kHz subsecond counter
+#define IDLE_RTC_PREDIV_S 3999 // 1Hz calendar
+#define IDLE_RTC_TICKS_PER_S (IDLE_RTC_PREDIV_S + 1)
+#define IDLE_RTC_TICKS_PER_DAY (86400U * IDLE_RTC_TICKS_PER_S)
+#define IDLE_RTC_TICK_US 250
+#define IDLE_RTC_MASKSS 12 // The alarm compares SS[11:0], enough for 0 to IDLE_RTC_PREDIV_S
+#define IDLE_RTC_TIMEOUT 100000 // Polling iterations, interrupts may be masked so HAL_GetTick cannot be used
+#define IDLE_STOP_MIN_US 1000 // Shorter waits are left to Sleep, the alarm resolution and the clock restore would eat them
+
+idle_stats_t idle_stats = {0};
+
+static uint8_t rtc_ready = 0;
+
+// External Variables
+extern UART_HandleTypeDef huart1;
+
+// Private Functions
+void idle_sleep(uint32_t next_expiry, uint8_t timer_armed);
+void idle_stop(uint32_t next_expiry, uint8_t timer_armed);
+uint8_t idle_rtc_wait(volatile uint32_t *reg, uint32_t flag);
+uint8_t idle_rtc_arm(uint32_t us);
+void idle_rtc_disarm();
+uint32_t idle_rtc_ticks();
+
+/*
+ * Start the RTC on the LSI as the wake-up source of Stop mode
+ * TIM2 stands still with the core clocks in Stop, so the RTC alarm wakes the core for the next software timer and the
+ * RTC counters carry the time spent in Stop over to TIM2. If the RTC does not start, Stop is only entered when no
+ * software timer is armed.
+ */
+void idle_init()
+{
+	rtc_ready = 0;
+	__HAL_RCC_LSI_ENABLE();
+	if(!idle_rtc_wait(&RCC->CSR2, RCC_CSR2_LSIRDY))
+	{
+		return;
+	}
+	__HAL_RCC_RTCAPB_CLK_ENABLE();
+	if(READ_BIT(RCC->CSR1, RCC_CSR1_RTCSEL) != RCC_RTCCLKSOURCE_LSI)
+	{
+		// The RTC clock source can only be changed through a reset of the RTC domain
+		__HAL_RCC_BACKUPRESET_FORCE();
+		__HAL_RCC_BACKUPRESET_RELEASE();
+		__HAL_RCC_RTC_CONFIG(RCC_RTCCLKSOURCE_LSI);
+	}
+	__HAL_RCC_RTC_ENABLE();
+
+	RTC->WPR = 0xCA;
+	RTC->WPR = 0x53;
+	RTC->ICSR |= RTC_ICSR_INIT;
+	if(idle_rtc_wait(&RTC->ICSR, RTC_ICSR_INITF))
+	{
+		RTC->PRER = IDLE_RTC_PREDIV_S << RTC_PRER_PREDIV_S_Pos;
+		RTC->PRER |= IDLE_RTC_PREDIV_A << RTC_PRER_PREDIV_A_Pos;
+		// Read the counters directly, the shadow registers are not resynchronised on a wake-up from Stop
+		RTC->CR = RTC_CR_BYPSHAD;
+		rtc_ready = 1;
+	}
+	RTC->ICSR &= ~RTC_ICSR_INIT;
+	RTC->WPR = 0xFF;
+
+	EXTI->IMR1 |= EXTI_IMR1_IM19;
+	HAL_NVIC_SetPriority(RTC_IRQn, 0, 0);
+	HAL_NVIC_EnableIRQ(RTC_IRQn);
+}
+
+/*
+ * Put the core to sleep until the next interrupt
+ * Must be called with interrupts disabled (PRIMASK set) after checking that the super-loop has no pending work,
+ * a pending interrupt still wakes the core and is serviced once the caller re-enables interrupts
+ */
+void idle_enter(uint8_t mode, uint8_t bus_idle)
+{
+	uint32_t next_expiry = 0;
+	uint8_t timer_armed = timer_next_expiry(&next_expiry);
+
+	if(mode == IDLE_MODE_RUN || (timer_armed && next_expiry == 0))
+	{
+		return;
+	}
+
+	// The timer service stops with the core clocks in Stop mode, the RTC alarm stands in for it on longer waits
+	if(mode == IDLE_MODE_STOP && bus_idle && (!timer_armed || (rtc_ready && next_expiry >= IDLE_STOP_MIN_US)))
+	{
+		idle_stop(next_expiry, timer_armed);
+	}
+	else
+	{
+		idle_sleep(next_expiry, timer_armed);
+	}
+}
+
+// Private Functions ---------------------------------------------------------------------------
+
+void idle_sleep(uint32_t next_expiry, uint8_t timer_armed)
+{
+	uint32_t start = timer_now();
+	HAL_PWR_EnterSLEEPMode(PWR_MAINREGULATOR_ON, PWR_SLEEPENTRY_WFI);
+	uint32_t elapsed = timer_now() - start;
+
+	// The SysTick that fell due in Sleep is taken after __enable_irq() in main(), it belongs to the idle time
+	if(SCB->ICSR & SCB_ICSR_PENDSTSET_Msk)
+	{
+		profile_idle();
+	}
+
+	idle_stats.sleep_count++;
+	idle_stats.sleep_time_us += elapsed;
+	idle_stats.sleep_time_ms += idle_stats.sleep_time_us / TIMER_TICKS_PER_MS;
+	idle_stats.sleep_time_us %= TIMER_TICKS_PER_MS;
+
+	// When the software timer woke the core, measure how late the core resumed relative to its deadline
+	if(timer_armed && elapsed >= next_expiry)
+	{
+		uint32_t latency = elapsed - next_expiry;
+		idle_stats.wake_latency = (latency > 0xFFFF) ? 0xFFFF : (uint16_t)latency;
+		if(idle_stats.wake_latency > idle_stats.wake_latency_max)
+		{
+			idle_stats.wake_latency_max = idle_stats.wake_latency;
+		}
+	}
+}
+
+void idle_stop(uint32_t next_expiry, uint8_t timer_armed)
+{
+	if(timer_armed && !idle_rtc_arm(next_expiry))
+	{
+		idle_sleep(next_expiry, timer_armed);
+		return;
+	}
+	uint32_t start = rtc_ready ? idle_rtc_ticks() : 0;
+
+	// Wake on the start bit of the next Modbus message, the wake-up source is set by modbus_port_reset()
+	// Reconfiguring it here would disable USART1 under a byte and wait for REACK with interrupts masked
+	HAL_UARTEx_EnableStopMode(&huart1);
+	__HAL_UART_ENABLE_IT(&huart1, UART_IT_WUF);
+
+	HAL_SuspendTick();
+	HAL_PWR_EnterSTOPMode(PWR_MAINREGULATOR_ON, PWR_STOPENTRY_WFI);
+
+	// The core resumes on HSISYS, restore the run mode clock tree before anything else
+	clock_restore();
+	if(rtc_ready)
+	{
+		// TIM2 stood still, move it on by the time the RTC measured so deadlines that fell due in Stop expire now
+		uint32_t elapsed = (idle_rtc_ticks() + IDLE_RTC_TICKS_PER_DAY - start) % IDLE_RTC_TICKS_PER_DAY;
+		timer_advance((elapsed > 0x7FFFFFFF / IDLE_RTC_TICK_US) ? 0x7FFFFFFF : elapsed * IDLE_RTC_TICK_US);
+		idle_rtc_disarm();
+	}
+	HAL_ResumeTick();
+
+	__HAL_UART_DISABLE_IT(&huart1, UART_IT_WUF);
+	HAL_UARTEx_DisableStopMode(&huart1);
+	idle_stats.stop_count++;
+}
+
+/*
+ * RTC alarm, only taken if the alarm fires after the core has left Stop for another reason
+ */
+void idle_rtc_irq_handler()
+{
+	idle_rtc_disarm();
+}
+
+uint8_t idle_rtc_wait(volatile uint32_t *reg, uint32_t flag)
+{
+	for(uint32_t i = 0; i < IDLE_RTC_TIMEOUT; i++)
+	{
+		if((*reg) & flag)
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Program the RTC alarm for us from now, rounded down so the core wakes early and sleeps out the rest on TIM2
+ * The alarm only compares the subseconds, a wait of a second or more wakes the core once a second
+ */
+uint8_t idle_rtc_arm(uint32_t us)
+{
+	uint32_t ticks = us / IDLE_RTC_TICK_US;
+	if(ticks >= IDLE_RTC_TICKS_PER_S)
+	{
+		ticks = IDLE_RTC_TICKS_PER_S - 1;
+	}
+
+	RTC->WPR = 0xCA;
+	RTC->WPR = 0x53;
+	RTC->CR &= ~(RTC_CR_ALRAE | RTC_CR_ALRAIE);
+	if(!idle_rtc_wait(&RTC->ICSR, RTC_ICSR_ALRAWF))
+	{
+		RTC->WPR = 0xFF;
+		return 0;
+	}
+	// The subsecond counter counts down
+	uint32_t target = (RTC->SSR + IDLE_RTC_TICKS_PER_S - ticks) % IDLE_RTC_TICKS_PER_S;
+	RTC->ALRMAR = RTC_ALRMAR_MSK4 | RTC_ALRMAR_MSK3 | RTC_ALRMAR_MSK2 | RTC_ALRMAR_MSK1;
+	RTC->ALRMASSR = (IDLE_RTC_MASKSS << RTC_ALRMASSR_MASKSS_Pos) | target;
+	RTC->SCR = RTC_SCR_CALRAF;
+	RTC->CR |= RTC_CR_ALRAE | RTC_CR_ALRAIE;
+	RTC->WPR = 0xFF;
+	return 1;
+}
+
+void idle_rtc_disarm()
+{
+	RTC->WPR = 0xCA;
+	RTC->WPR = 0x53;
+	RTC->CR &= ~(RTC_CR_ALRAE | RTC_CR_ALRAIE);
+	RTC->SCR = RTC_SCR_CALRAF;
+	RTC->WPR = 0xFF;
+	HAL_NVIC_ClearPendingIRQ(RTC_IRQn);
+}
+
+/*
+ * RTC time of day in subsecond ticks
+ */
+uint32_t idle_rtc_ticks()
+{
+	uint32_t ss;
+	uint32_t tr;
+	// Without the shadow registers the second may roll over between the two reads, the subseconds show it
+	do
+	{
+		ss = RTC->SSR;
+		tr = RTC->TR;
+	}while(ss != RTC->SSR);
+
+	uint32_t hours = ((tr & RTC_TR_HT) >> RTC_TR_HT_Pos) * 10 + ((tr & RTC_TR_HU) >> RTC_TR_HU_Pos);
+	uint32_t minutes = ((tr & RTC_TR_MNT) >> RTC_TR_MNT_Pos) * 10 + ((tr & RTC_TR_MNU) >> RTC_TR_MNU_Pos);
+	uint32_t seconds = ((tr & RTC_TR_ST) >> RTC_TR_ST_Pos) * 10 + ((tr & RTC_TR_SU) >> RTC_TR_SU_Pos);
+	return ((hours * 60 + minutes) * 60 + seconds) * IDLE_RTC_TICKS_PER_S + (IDLE_RTC_PREDIV_S - (ss & RTC_SSR_SS));
+}
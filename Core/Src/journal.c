@@ -0,0 +1,326 @@
+/*
+ * journal.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: Victor Kalenda
+ *
+ */
+
+#include "journal.h"
+#include "fault.h"
+#include "error_codes.h"
+#include "modbus.h"
+#include "timer.h"
+#include "stm32c0xx_hal.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define JOURNAL_FIRST_PAGE (FLASH_PAGE_NB - 1 - JOURNAL_PAGES) // The last page holds the emulated EEPROM
+#define JOURNAL_RECORD_CRC_SIZE offsetof(journal_record_t, crc)
+
+static journal_record_t queue[JOURNAL_QUEUE_SIZE];
+static uint8_t queue_count = 0;
+static uint8_t tokens = JOURNAL_BURST;
+static uint32_t refill_time = 0; // TIM2 count of the last token refill
+static uint32_t next_sequence = 0;
+static uint16_t next_slot = 0;
+static uint16_t boot = 0;
+static uint16_t dropped = 0;
+
+// Private Functions
+const journal_record_t *journal_slot(uint16_t slot);
+uint8_t journal_valid(const journal_record_t *record);
+uint8_t journal_blank(uint16_t first_slot, uint16_t num_slots);
+uint8_t journal_prepare_slot();
+void journal_commit();
+void journal_drop(uint8_t count);
+uint16_t journal_register(uint16_t record);
+
+/*
+ * Find where the last power cycle stopped writing and log the reset
+ * Call once at power up, before anything else is logged
+ */
+void journal_init()
+{
+	uint8_t found = 0;
+	uint16_t newest_slot = 0;
+	for(uint16_t slot = 0; slot < JOURNAL_SLOTS; slot++)
+	{
+		const journal_record_t *record = journal_slot(slot);
+		if(journal_valid(record) && (!found || (int32_t)(record->sequence - journal_slot(newest_slot)->sequence) > 0))
+		{
+			found = 1;
+			newest_slot = slot;
+		}
+	}
+	if(found)
+	{
+		next_sequence = journal_slot(newest_slot)->sequence + 1;
+		next_slot = (newest_slot + 1) % JOURNAL_SLOTS;
+		boot = journal_slot(newest_slot)->boot + 1;
+	}
+	refill_time = timer_now();
+
+	uint8_t reset_flags = (RCC->CSR2 >> 24) & 0xFF;
+	__HAL_RCC_CLEAR_RESET_FLAGS();
+	journal_log(JOURNAL_RESET, reset_flags, 0);
+	const fault_record_t *fault = fault_unreported();
+	if(fault != NULL)
+	{
+		journal_log(JOURNAL_HARDFAULT, fault->source, (fault->frame[FAULT_PC] - FLASH_BASE) >> 1);
+	}
+}
+
+/*
+ * Queue a record, it reaches the flash with the next commit
+ * May be called from interrupt context
+ */
+void journal_log(uint8_t event, uint8_t detail, uint16_t data)
+{
+	uint32_t time = timer_now();
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	if(queue_count < JOURNAL_QUEUE_SIZE && tokens > 0)
+	{
+		journal_record_t *record = &queue[queue_count++];
+		tokens--;
+		record->time = time;
+		record->boot = boot;
+		record->event = event;
+		record->detail = detail;
+		record->data = data;
+	}
+	else if(dropped < 0xFFFF)
+	{
+		dropped++;
+	}
+
+	__set_PRIMASK(primask);
+}
+
+void journal_service()
+{
+	uint32_t now = timer_now();
+	if(tokens >= JOURNAL_BURST)
+	{
+		refill_time = now;
+	}
+	else if(now - refill_time >= JOURNAL_REFILL_TIME * TIMER_TICKS_PER_MS)
+	{
+		refill_time = now;
+		tokens++;
+	}
+
+	if(queue_count == 0)
+	{
+		return;
+	}
+	if(timer_expired(TIMER_JOURNAL))
+	{
+		journal_commit();
+	}
+	else if(!timer_running(TIMER_JOURNAL))
+	{
+		timer_start(TIMER_JOURNAL, JOURNAL_COMMIT_DELAY, NULL);
+	}
+}
+
+/*
+ * Copy length registers of the journal file from record on into data, high byte first
+ */
+int8_t journal_read(uint16_t record, uint16_t length, uint8_t *data)
+{
+	if((uint32_t)record + length > JOURNAL_FILE_SIZE)
+	{
+		return MB_ILLEGAL_DATA_ADDRESS;
+	}
+	for(uint16_t i = 0; i < length; i++)
+	{
+		uint16_t value = journal_register(record + i);
+		data[2 * i] = (value >> 8) & 0xFF;
+		data[2 * i + 1] = value & 0xFF;
+	}
+	return MB_SUCCESS;
+}
+
+// Private Functions ---------------------------------------------------------------------------
+
+const journal_record_t *journal_slot(uint16_t slot)
+{
+	return (const journal_record_t *)(FLASH_BASE + JOURNAL_FIRST_PAGE * FLASH_PAGE_SIZE + slot * sizeof(journal_record_t));
+}
+
+uint8_t journal_valid(const journal_record_t *record)
+{
+	return (record->sequence != 0xFFFFFFFF) && (crc_16((uint8_t *)record, JOURNAL_RECORD_CRC_SIZE) == record->crc);
+}
+
+uint8_t journal_blank(uint16_t first_slot, uint16_t num_slots)
+{
+	const uint32_t *word = (const uint32_t *)journal_slot(first_slot);
+	for(uint32_t i = 0; i < num_slots * sizeof(journal_record_t) / 4; i++)
+	{
+		if(word[i] != 0xFFFFFFFF)
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/*
+ * Move next_slot to a slot that can be programmed, erasing the oldest page when a new page is started
+ * Slots left half written by a power loss are skipped, returns 0 if the flash could not be erased
+ */
+uint8_t journal_prepare_slot()
+{
+	while(1)
+	{
+		if(next_slot % JOURNAL_PAGE_RECORDS == 0 && !journal_blank(next_slot, JOURNAL_PAGE_RECORDS))
+		{
+			FLASH_EraseInitTypeDef erase = {
+				.TypeErase = FLASH_TYPEERASE_PAGES,
+				.Page = JOURNAL_FIRST_PAGE + next_slot / JOURNAL_PAGE_RECORDS,
+				.NbPages = 1
+			};
+			uint32_t error = 0;
+			if(HAL_FLASHEx_Erase(&erase, &error) != HAL_OK || !journal_blank(next_slot, JOURNAL_PAGE_RECORDS))
+			{
+				return 0;
+			}
+		}
+		if(journal_blank(next_slot, 1))
+		{
+			return 1;
+		}
+		next_slot = (next_slot + 1) % JOURNAL_SLOTS;
+	}
+}
+
+/*
+ * Program the queued records, the flash stalls the core while a page is erased, as it does for EE_Write()
+ */
+void journal_commit()
+{
+	journal_record_t batch[JOURNAL_QUEUE_SIZE];
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	uint8_t count = queue_count;
+	for(uint8_t i = 0; i < count; i++)
+	{
+		batch[i] = queue[i];
+	}
+	queue_count = 0;
+	__set_PRIMASK(primask);
+
+	HAL_FLASH_Unlock();
+	for(uint8_t i = 0; i < count; i++)
+	{
+		if(!journal_prepare_slot())
+		{
+			journal_drop(count - i);
+			break;
+		}
+		journal_record_t *record = &batch[i];
+		record->sequence = next_sequence;
+		record->crc = crc_16((uint8_t *)record, JOURNAL_RECORD_CRC_SIZE);
+
+		uint32_t address = (uint32_t)journal_slot(next_slot);
+		uint8_t written = 1;
+		for(uint8_t j = 0; j < sizeof(journal_record_t) / 8; j++)
+		{
+			uint64_t doubleword;
+			memcpy(&doubleword, (uint8_t *)record + j * 8, 8);
+			if(HAL_FLASH_Program(FLASH_TYPEPROGRAM_DOUBLEWORD, address + j * 8, doubleword) != HAL_OK)
+			{
+				written = 0;
+				break;
+			}
+		}
+		// A slot that failed to program is skipped by the next journal_prepare_slot()
+		next_slot = (next_slot + 1) % JOURNAL_SLOTS;
+		if(written && journal_valid(journal_slot((next_slot + JOURNAL_SLOTS - 1) % JOURNAL_SLOTS)))
+		{
+			next_sequence++;
+		}
+		else
+		{
+			journal_drop(1);
+		}
+	}
+	HAL_FLASH_Lock();
+}
+
+void journal_drop(uint8_t count)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	dropped = (dropped + count > 0xFFFF) ? 0xFFFF : dropped + count;
+	__set_PRIMASK(primask);
+}
+
+uint16_t journal_register(uint16_t record)
+{
+	switch(record)
+	{
+		case 0:
+		{
+			return (next_sequence >> 16) & 0xFFFF;
+		}
+		case 1:
+		{
+			return next_sequence & 0xFFFF;
+		}
+		case 2:
+		{
+			return dropped;
+		}
+		case 3:
+		{
+			return JOURNAL_ENTRY_SIZE;
+		}
+	}
+
+	// The oldest page is the one after the page holding the newest record
+	uint16_t newest_page = ((next_slot + JOURNAL_SLOTS - 1) % JOURNAL_SLOTS) / JOURNAL_PAGE_RECORDS;
+	uint16_t oldest_slot = ((newest_page + 1) % JOURNAL_PAGES) * JOURNAL_PAGE_RECORDS;
+	uint16_t slot = (oldest_slot + (record - JOURNAL_FILE_HEADER) / JOURNAL_ENTRY_SIZE) % JOURNAL_SLOTS;
+	const journal_record_t *entry = journal_slot(slot);
+	if(!journal_valid(entry))
+	{
+		return 0; // JOURNAL_EMPTY
+	}
+	switch((record - JOURNAL_FILE_HEADER) % JOURNAL_ENTRY_SIZE)
+	{
+		case 0:
+		{
+			return (entry->sequence >> 16) & 0xFFFF;
+		}
+		case 1:
+		{
+			return entry->sequence & 0xFFFF;
+		}
+		case 2:
+		{
+			return (entry->time >> 16) & 0xFFFF;
+		}
+		case 3:
+		{
+			return entry->time & 0xFFFF;
+		}
+		case 4:
+		{
+			return entry->boot;
+		}
+		case 5:
+		{
+			return (entry->event << 8) | entry->detail;
+		}
+		default:
+		{
+			return entry->data;
+		}
+	}
+}
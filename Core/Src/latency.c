@@ -0,0 +1,134 @@
+/*
+ * latency.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: Victor Kalenda
+ *
+ */
+
+#include "latency.h"
+#include <stdint.h>
+#include <string.h>
+
+typedef struct latency_span_s
+{
+	uint16_t min;
+	uint16_t max;
+	uint64_t sum;
+}latency_span_t;
+
+typedef struct latency_stats_s
+{
+	uint32_t count;
+	latency_span_t stage[NUM_LATENCY_STAGES];
+	uint16_t bucket[NUM_LATENCY_BUCKETS];
+}latency_stats_t;
+
+static latency_stats_t latency_stats[NUM_LATENCY_CLASSES];
+
+// Private Functions
+uint8_t latency_class(uint8_t function_code);
+uint8_t latency_bucket(uint32_t time);
+
+/*
+ * Add one transaction, event_time holds the TIM2 time of each latency_event_t
+ * Runs from the super-loop, the interrupts only take the timestamps
+ */
+void latency_record(uint8_t function_code, const uint32_t *event_time)
+{
+	uint32_t stage_time[NUM_LATENCY_STAGES] = {
+		[LATENCY_RECEIVE] = event_time[LATENCY_FRAME_END] - event_time[LATENCY_FIRST_BYTE],
+		[LATENCY_DISPATCH] = event_time[LATENCY_MAIN] - event_time[LATENCY_FRAME_END],
+		[LATENCY_PROCESS] = event_time[LATENCY_SEND] - event_time[LATENCY_MAIN],
+		[LATENCY_TRANSMIT] = event_time[LATENCY_TX_COMPLETE] - event_time[LATENCY_SEND],
+		[LATENCY_RESPONSE] = event_time[LATENCY_TX_COMPLETE] - event_time[LATENCY_FRAME_END]
+	};
+	latency_stats_t *stats = &latency_stats[latency_class(function_code)];
+	if(stats->count < 0xFFFFFFFF)
+	{
+		stats->count++;
+	}
+	for(uint8_t i = 0; i < NUM_LATENCY_STAGES; i++)
+	{
+		latency_span_t *span = &stats->stage[i];
+		uint16_t time = (stage_time[i] > 0xFFFF) ? 0xFFFF : stage_time[i];
+		if(stats->count == 1 || time < span->min)
+		{
+			span->min = time;
+		}
+		if(time > span->max)
+		{
+			span->max = time;
+		}
+		span->sum += stage_time[i];
+	}
+	uint16_t *bucket = &stats->bucket[latency_bucket(stage_time[LATENCY_RESPONSE])];
+	if((*bucket) < 0xFFFF)
+	{
+		(*bucket)++;
+	}
+}
+
+void latency_reset()
+{
+	memset(latency_stats, 0, sizeof(latency_stats));
+}
+
+/*
+ * Copy the statistics into the register block starting at registers, see latency.h for the layout
+ */
+void latency_export(uint16_t *registers)
+{
+	for(uint8_t c = 0; c < NUM_LATENCY_CLASSES; c++)
+	{
+		latency_stats_t *stats = &latency_stats[c];
+		uint16_t *block = &registers[c * LATENCY_CLASS_SIZE];
+		block[0] = (stats->count >> 16) & 0xFFFF;
+		block[1] = stats->count & 0xFFFF;
+		for(uint8_t i = 0; i < NUM_LATENCY_STAGES; i++)
+		{
+			uint64_t mean = (stats->count > 0) ? stats->stage[i].sum / stats->count : 0;
+			block[2 + i * 3] = stats->stage[i].min;
+			block[3 + i * 3] = stats->stage[i].max;
+			block[4 + i * 3] = (mean > 0xFFFF) ? 0xFFFF : mean;
+		}
+		memcpy(&block[2 + NUM_LATENCY_STAGES * 3], stats->bucket, sizeof(stats->bucket));
+	}
+}
+
+// Private Functions ---------------------------------------------------------------------------
+
+uint8_t latency_class(uint8_t function_code)
+{
+	switch(function_code)
+	{
+		case 0x03:
+		{
+			return LATENCY_CLASS_READ_HOLDING;
+		}
+		case 0x04:
+		{
+			return LATENCY_CLASS_READ_INPUT;
+		}
+		case 0x10:
+		{
+			return LATENCY_CLASS_WRITE_MULTIPLE;
+		}
+		default:
+		{
+			return LATENCY_CLASS_OTHER;
+		}
+	}
+}
+
+uint8_t latency_bucket(uint32_t time)
+{
+	uint8_t bucket = 0;
+	time >>= LATENCY_BUCKET_SHIFT;
+	while(time > 0 && bucket < NUM_LATENCY_BUCKETS - 1)
+	{
+		time >>= 1;
+		bucket++;
+	}
+	return bucket;
+}
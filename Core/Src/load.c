@@ -0,0 +1,125 @@
+/*
+ * load.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: Victor Kalenda
+ *
+ */
+
+#include "load.h"
+#include "timer.h"
+#include <stdint.h>
+#include <string.h>
+
+typedef struct load_stats_s
+{
+	uint32_t iterations;
+	uint32_t period_min;
+	uint32_t period_max;
+	uint64_t period_sum;
+	uint32_t busy_max;
+	uint32_t rate; // Of the last complete window
+	uint16_t idle; // Of the last complete window
+}load_stats_t;
+
+static load_stats_t load_stats;
+static uint8_t started = 0;
+static uint32_t loop_start = 0; // TIM2 time at the top of this iteration
+static uint32_t busy_end = 0; // TIM2 time this iteration went idle
+static uint32_t window_start = 0;
+static uint32_t window_iterations = 0;
+static uint32_t window_idle = 0;
+
+// Private Functions
+void load_put(uint16_t *registers, uint32_t value);
+
+/*
+ * Call at the top of every super-loop iteration
+ */
+void load_loop()
+{
+	uint32_t now = timer_now();
+	if(!started)
+	{
+		started = 1;
+		window_start = now;
+	}
+	else
+	{
+		uint32_t period = now - loop_start;
+		if(load_stats.iterations < 0xFFFFFFFF)
+		{
+			load_stats.iterations++;
+		}
+		if(load_stats.iterations == 1 || period < load_stats.period_min)
+		{
+			load_stats.period_min = period;
+		}
+		if(period > load_stats.period_max)
+		{
+			load_stats.period_max = period;
+		}
+		load_stats.period_sum += period;
+
+		window_iterations++;
+		window_idle += now - busy_end;
+		uint32_t window = now - window_start;
+		if(window >= LOAD_WINDOW)
+		{
+			load_stats.rate = (uint64_t)window_iterations * 1000000 / window;
+			load_stats.idle = (uint64_t)window_idle * 10000 / window;
+			window_start = now;
+			window_iterations = 0;
+			window_idle = 0;
+		}
+	}
+	loop_start = now;
+	busy_end = now;
+}
+
+/*
+ * Call when the super-loop has run out of work, just before it decides whether to sleep
+ */
+void load_busy_end()
+{
+	if(!started)
+	{
+		return;
+	}
+	busy_end = timer_now();
+	if(busy_end - loop_start > load_stats.busy_max)
+	{
+		load_stats.busy_max = busy_end - loop_start;
+	}
+}
+
+void load_reset()
+{
+	memset(&load_stats, 0, sizeof(load_stats));
+	window_iterations = 0;
+	window_idle = 0;
+	started = 0;
+}
+
+/*
+ * Copy the statistics into the register block starting at registers, see load.h for the layout
+ */
+void load_export(uint16_t *registers)
+{
+	uint64_t mean = (load_stats.iterations > 0) ? load_stats.period_sum / load_stats.iterations : 0;
+	load_put(&registers[0], load_stats.rate);
+	registers[2] = load_stats.idle;
+	load_put(&registers[3], load_stats.iterations);
+	load_put(&registers[5], load_stats.period_min);
+	load_put(&registers[7], load_stats.period_max);
+	load_put(&registers[9], (mean > 0xFFFFFFFF) ? 0xFFFFFFFF : mean);
+	load_put(&registers[11], load_stats.busy_max);
+}
+
+// Private Functions ---------------------------------------------------------------------------
+
+void load_put(uint16_t *registers, uint32_t value)
+{
+	registers[0] = (value >> 16) & 0xFFFF;
+	registers[1] = value & 0xFFFF;
+}
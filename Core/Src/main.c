@@ -24,16 +24,31 @@
 #include "modbus.h"
 #include "error_codes.h"
 #include "ee.h"
+#include "timer.h"
+#include "idle.h"
+#include "clock.h"
+#include "sync.h"
+#include "gateway.h"
+#include "telemetry.h"
+#include "diag.h"
+#include "journal.h"
+#include "profile.h"
+#include <string.h>
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
 /* USER CODE BEGIN PTD */
+typedef enum relay_stage_e
+{
+	RELAY_STAGE_STAGGER, // Waiting out this board's slot in the fleet-wide window
+	RELAY_STAGE_480 // 120VAC relay driven, waiting to drive the 480VAC relay
+}relay_stage_t;
 
 /* USER CODE END PTD */
 
 /* Private define ------------------------------------------------------------*/
 /* USER CODE BEGIN PD */
-
+#define RELAY_SEQUENCE_DELAY 1000 // ms between energising the 120VAC and 480VAC relays
 /* USER CODE END PD */
 
 /* Private macro -------------------------------------------------------------*/
@@ -44,8 +59,13 @@
 /* Private variables ---------------------------------------------------------*/
 
 UART_HandleTypeDef huart1;
+UART_HandleTypeDef huart2;
 DMA_HandleTypeDef hdma_usart1_rx;
 DMA_HandleTypeDef hdma_usart1_tx;
+DMA_HandleTypeDef hdma_usart2_rx;
+DMA_HandleTypeDef hdma_usart2_tx;
+
+TIM_HandleTypeDef htim2;
 
 /* USER CODE BEGIN PV */
 
@@ -57,14 +77,69 @@ uint16_t holding_register_database[NUM_HOLDING_REGISTERS] = {
 	0x0000, // MB_ERRORS
     0x0000,	// GPIO_READ
 	0x0000,	// GPIO_WRITE
-	0x03E8	// WDG_TIME
+	0x03E8,	// WDG_TIME
+	IDLE_MODE_STOP, // IDLE_MODE
+	CLOCK_PROFILE_HSE_8MHZ, // CLOCK_PROFILE
+	0x0001, // CLOCK_SCALING
+	0x0000, // MB_BAUD_HIGH
+	0x2580, // MB_BAUD_LOW
+	AUTO_BAUD_DISABLED, // MB_AUTO_BAUD
+	  2000, // MB_BAUD_PROBATION
+	0x0000, // MB_GROUP_1
+	0x0000, // MB_GROUP_2
+	0x0000, // MB_GROUP_3
+	0x0000, // MB_GROUP_4
+	0x0000, // SYNC_EPOCH_HIGH
+	0x0000, // SYNC_EPOCH_LOW
+	0x0000, // SCHEDULE_GPIO
+	0x0000, // SCHEDULE_TIME_HIGH
+	0x0000, // SCHEDULE_TIME_LOW
+	STAGGER_DISABLED, // RELAY_STAGGER_MODE
+	0x0000, // RELAY_STAGGER_SLOT
+	  32, // RELAY_STAGGER_SLOTS
+	  100, // RELAY_STAGGER_STEP
+	0x0003, // MB2_BAUD_RATE
+	MODBUS_PORT_2_DEFAULT_ROLE, // MB2_ROLE
+	0x0001, // MB2_ID
+	0x0001, // WDG_PORTS
+	   100, // GATEWAY_TIMEOUT
+	0x0000, // GATEWAY_1_ID
+	0x0003, // GATEWAY_1_FUNCTION
+	0x0000, // GATEWAY_1_ADDRESS
+	0x0001, // GATEWAY_1_COUNT
+	  1000, // GATEWAY_1_INTERVAL
+	0x0000, // GATEWAY_2_ID
+	0x0003, // GATEWAY_2_FUNCTION
+	0x0000, // GATEWAY_2_ADDRESS
+	0x0001, // GATEWAY_2_COUNT
+	  1000, // GATEWAY_2_INTERVAL
+	0x0000, // GATEWAY_3_ID
+	0x0003, // GATEWAY_3_FUNCTION
+	0x0000, // GATEWAY_3_ADDRESS
+	0x0001, // GATEWAY_3_COUNT
+	  1000, // GATEWAY_3_INTERVAL
+	0x0000, // GATEWAY_4_ID
+	0x0003, // GATEWAY_4_FUNCTION
+	0x0000, // GATEWAY_4_ADDRESS
+	0x0001, // GATEWAY_4_COUNT
+	  1000, // GATEWAY_4_INTERVAL
+	TELEMETRY_OFF, // TELEMETRY_MODE
+	    10, // TELEMETRY_INTERVAL
+	0x0000, // LATENCY_RESET
+	0x0000, // ERROR_SNAPSHOT
+	PROFILE_STOP, // PROFILE_CONTROL
+	0x0000 // LOAD_RESET
 };
 
+uint16_t input_register_database[NUM_INPUT_REGISTERS] = {0};
+
 uint16_t prev_gpio_write_register;
-uint32_t wdg_time;
 uint8_t shutdown;
 
-uint8_t prev_gpio_state;
+ee_storage_t ee;
+uint8_t relay_sequence_state;
+uint8_t relay_sequence_stage;
+volatile uint8_t gpio_event;
 
 /* USER CODE END PV */
 
@@ -73,8 +148,20 @@ void SystemClock_Config(void);
 static void MX_GPIO_Init(void);
 static void MX_DMA_Init(void);
 static void MX_USART1_UART_Init(void);
+static void MX_TIM2_Init(void);
+static void MX_USART2_UART_Init(void);
 /* USER CODE BEGIN PFP */
-
+void feed_watchdog();
+void feed_watchdog_port(uint8_t port);
+void relay_sequence_start(uint8_t gpio_state, uint8_t stagger);
+void relay_sequence_service();
+void relay_sequence_energise();
+uint32_t relay_stagger_delay();
+void relay_stagger_restore();
+void ee_validate();
+void relay_stagger_store();
+void refresh_input_registers();
+uint8_t work_pending();
 /* USER CODE END PFP */
 
 /* Private user code ---------------------------------------------------------*/
@@ -92,6 +179,7 @@ int main(void)
   /* USER CODE BEGIN 1 */
 	int8_t modbus_status = HAL_OK;
 	uint8_t modbus_tx_len = 0;
+	GPIO_PinState estop_state = GPIO_PIN_RESET;
   /* USER CODE END 1 */
 
   /* MCU Configuration--------------------------------------------------------*/
@@ -114,16 +202,31 @@ int main(void)
   MX_GPIO_Init();
   MX_DMA_Init();
   MX_USART1_UART_Init();
+  MX_TIM2_Init();
+  MX_USART2_UART_Init();
   /* USER CODE BEGIN 2 */
+  timer_init();
+  idle_init();
+  clock_set_profile(holding_register_database[CLOCK_PROFILE]);
 
-  EE_Init(&prev_gpio_state, sizeof(uint8_t));
+  EE_Init(&ee, sizeof(ee_storage_t));
   EE_Read();
-
-  if(modbus_set_rx() != HAL_OK)
+  ee_validate();
+  journal_init();
+  estop_state = HAL_GPIO_ReadPin(ESTOP_SENSE_GPIO_Port, ESTOP_SENSE_Pin);
+  modbus_restore_address();
+  modbus_restore_port_config();
+  relay_stagger_restore();
+#ifdef MB_MASTER
+  gateway_restore();
+#endif
+  telemetry_restore();
+
+  if(modbus_restore_baud_rate() != HAL_OK)
   {
 	  Error_Handler();
   }
-  wdg_time = 0;
+  feed_watchdog();
   shutdown = 0;
   /* USER CODE END 2 */
 
@@ -131,30 +234,34 @@ int main(void)
   /* USER CODE BEGIN WHILE */
   while (1)
   {
+	  load_loop();
+	  gpio_event = 0;
+
+	  // Journal the E-stop in either mode, polling the level leaves out contact bounce within an iteration
+	  if(HAL_GPIO_ReadPin(ESTOP_SENSE_GPIO_Port, ESTOP_SENSE_Pin) != estop_state)
+	  {
+		  estop_state = !estop_state;
+		  journal_log(JOURNAL_ESTOP, estop_state, 0);
+	  }
+	  clock_service(holding_register_database[CLOCK_PROFILE], holding_register_database[CLOCK_SCALING], (modbus_bus_idle() && telemetry_idle()) || shutdown);
 	  if(HAL_GPIO_ReadPin(MANUAL_GPIO_Port, MANUAL_Pin) == GPIO_PIN_SET)
 	  {
 		  if(shutdown)
 		  {
-			  // Set all GPIO pins to previous_state
-			  if((prev_gpio_state & RELAY_120_MASK) != 0)
-			  {
-				  HAL_GPIO_WritePin(RELAY_120_GPIO_Port, RELAY_120_Pin, GPIO_PIN_SET);
-			  }
-			  HAL_Delay(1000);
-			  if((prev_gpio_state & RELAY_480_MASK) != 0)
-			  {
-				  HAL_GPIO_WritePin(RELAY_480_GPIO_Port, RELAY_480_Pin, GPIO_PIN_SET);
-			  }
-			  wdg_time = HAL_GetTick();
+			  journal_log(JOURNAL_MANUAL, 0, 0);
+
+			  // Set all GPIO pins to previous_state, the 480VAC relay follows once the sequence delay elapses
+			  relay_sequence_start(ee.gpio_state, 1);
+			  feed_watchdog();
 
 			  // Carry the pin changes to the register database
-			  holding_register_database[GPIO_WRITE] = prev_gpio_state;
+			  holding_register_database[GPIO_WRITE] = ee.gpio_state;
 
 			  // Restart the Modbus
 			  modbus_status = modbus_startup();
 			  if(modbus_status != 0)
 			  {
-				  holding_register_database[MB_ERRORS] |= 1U << ((modbus_status) + (MB_FATAL_ERROR - RANGE_ERROR));
+				  handle_modbus_error(modbus_status);
 			  }
 
 			  // Ensure this code only executes once
@@ -167,40 +274,58 @@ int main(void)
 		  holding_register_database[GPIO_READ] = ((estop_sense << ESTOP_SENSE_POS) | (sense_120 << SENSE_120_POS));
 
 		  // Handle adjustment of the GPIO_WRITE pins
-		  if(prev_gpio_state != holding_register_database[GPIO_WRITE])
+		  if(ee.gpio_state != holding_register_database[GPIO_WRITE])
 		  {
-			  if((prev_gpio_state & RELAY_120_MASK) != (holding_register_database[GPIO_WRITE] & RELAY_120_MASK))
-			  {
-				  HAL_GPIO_WritePin(RELAY_120_GPIO_Port, RELAY_120_Pin, (holding_register_database[GPIO_WRITE] & RELAY_120_MASK));
-			  }
-			  if((prev_gpio_state & RELAY_480_MASK) != (holding_register_database[GPIO_WRITE] & RELAY_480_MASK))
-			  {
-				  HAL_GPIO_WritePin(RELAY_480_GPIO_Port, RELAY_480_Pin, (holding_register_database[GPIO_WRITE] & RELAY_480_MASK));
-			  }
-			  prev_gpio_state = holding_register_database[GPIO_WRITE];
+			  // The host's command takes precedence over any sequence still in progress, including one still in its stagger delay
+			  // timer_stop also clears an expiry that relay_sequence_service has not consumed yet
+			  timer_stop(TIMER_RELAY_SEQUENCE);
+			  HAL_GPIO_WritePin(RELAY_120_GPIO_Port, RELAY_120_Pin, (holding_register_database[GPIO_WRITE] & RELAY_120_MASK));
+			  HAL_GPIO_WritePin(RELAY_480_GPIO_Port, RELAY_480_Pin, (holding_register_database[GPIO_WRITE] & RELAY_480_MASK));
+			  ee.gpio_state = holding_register_database[GPIO_WRITE];
+			  EE_Write();
+			  feed_watchdog();
+		  }
+
+		  // Keep the stagger policy in the emulated EEPROM so it applies when power returns
+		  relay_stagger_store();
+#ifdef MB_MASTER
+		  gateway_store();
+#endif
+		  telemetry_store();
+
+		  // A scheduled relay change has already been applied to the outputs, carry it to the register database
+		  uint8_t scheduled_gpio = 0;
+		  if(sync_fired(&scheduled_gpio))
+		  {
+			  timer_stop(TIMER_RELAY_SEQUENCE);
+			  holding_register_database[GPIO_WRITE] = scheduled_gpio;
+			  ee.gpio_state = scheduled_gpio;
 			  EE_Write();
-			  wdg_time = HAL_GetTick();
 		  }
 
 		  // Handle Watchdog Timeout
-		  if(HAL_GetTick() - wdg_time > (uint32_t)(holding_register_database[WDG_TIMEOUT]))
+		  if(timer_expired(TIMER_WDG))
 		  {
+			  journal_log(JOURNAL_WATCHDOG, ee.gpio_state, 0);
+			  timer_stop(TIMER_RELAY_SEQUENCE);
+			  sync_cancel();
+
 			  // Turn off the TBM
 			  HAL_GPIO_WritePin(RELAY_480_GPIO_Port, RELAY_480_Pin, GPIO_PIN_RESET);
 			  HAL_GPIO_WritePin(RELAY_120_GPIO_Port, RELAY_120_Pin, GPIO_PIN_RESET);
 
 			  // Update the holding register database
 			  holding_register_database[GPIO_WRITE] = 0;
-			  prev_gpio_state = 0;
+			  ee.gpio_state = 0;
 			  EE_Write();
 		  }
 
 		  // Handle Modbus Communication
 		  if(modbus_rx())
 		  {
-			  if(get_rx_buffer(0) == holding_register_database[MODBUS_ID]) // Check Slave ID
+			  if(get_rx_buffer(0) == modbus_own_id()) // Check Slave ID
 			  {
-				  wdg_time = HAL_GetTick();
+				  feed_watchdog_port(modbus_rx_port());
 				  switch(get_rx_buffer(1))
 				  {
 					  case 0x03:
@@ -209,6 +334,23 @@ int main(void)
 						  modbus_status = return_holding_registers(&modbus_tx_len);
 						  break;
 					  }
+					  case MB_DIAGNOSTICS:
+					  {
+						  modbus_status = modbus_diagnostics(&modbus_tx_len);
+						  break;
+					  }
+					  case MB_READ_FILE_RECORD:
+					  {
+						  modbus_status = modbus_read_file_record(&modbus_tx_len);
+						  break;
+					  }
+					  case 0x04:
+					  {
+						  // Return input registers
+						  refresh_input_registers();
+						  modbus_status = return_input_registers(&modbus_tx_len);
+						  break;
+					  }
 					  case 0x10:
 					  {
 						  // Write holding registers
@@ -223,7 +365,34 @@ int main(void)
 				  }
 				  if(modbus_status != 0)
 				  {
-					  holding_register_database[MB_ERRORS] |= 1U << ((modbus_status) + (MB_FATAL_ERROR - RANGE_ERROR));
+					  handle_modbus_error(modbus_status);
+				  }
+			  }
+			  // Broadcast and group commands, only writes make sense when nobody responds
+			  else if(modbus_broadcast_match(get_rx_buffer(0)))
+			  {
+				  feed_watchdog_port(modbus_rx_port());
+				  if(get_rx_buffer(1) == 0x10)
+				  {
+					  modbus_status = edit_multiple_registers(&modbus_tx_len);
+				  }
+				  else
+				  {
+					  modbus_status = modbus_set_rx();
+				  }
+				  if(modbus_status != 0)
+				  {
+					  handle_modbus_error(modbus_status);
+				  }
+			  }
+			  // Collision free discovery of boards by their device UID, MODBUS_ID belongs to the bus on port 1
+			  else if((get_rx_buffer(0) == MB_DISCOVERY_ADDRESS) && (get_rx_buffer(1) == MB_ENUMERATE) &&
+					  (modbus_rx_port() == MODBUS_PORT_1))
+			  {
+				  modbus_status = modbus_enumerate(&modbus_tx_len);
+				  if(modbus_status != 0)
+				  {
+					  handle_modbus_error(modbus_status);
 				  }
 			  }
 			  // Special case where you retrieve the modbus ID
@@ -235,10 +404,14 @@ int main(void)
 				  modbus_status = return_holding_registers(&modbus_tx_len);
 				  if(modbus_status != 0)
 				  {
-					  holding_register_database[MB_ERRORS] |= 1U << ((modbus_status) + (MB_FATAL_ERROR - RANGE_ERROR));
+					  handle_modbus_error(modbus_status);
 				  }
 			  }
 		  }
+#ifdef MB_MASTER
+		  // Poll the downstream devices on the master port
+		  gateway_service();
+#endif
 		  modbus_status = monitor_modbus();
 		  if(modbus_status != HAL_OK && modbus_status != HAL_BUSY)
 		  {
@@ -252,7 +425,7 @@ int main(void)
 						  while(monitor_modbus() == HAL_BUSY);
 						  if(modbus_status != HAL_OK)
 						  {
-							  holding_register_database[MB_ERRORS] |= 1U << ((modbus_status) + (MB_FATAL_ERROR - RANGE_ERROR));
+							  handle_modbus_error(modbus_status);
 						  }
 					  }
 					  break;
@@ -264,10 +437,7 @@ int main(void)
 				  }
 				  case MB_UART_ERROR:
 				  {
-					  if(modbus_status != 0)
-					  {
-						  holding_register_database[MB_ERRORS] |= 1U << ((modbus_status) + (MB_FATAL_ERROR - RANGE_ERROR));
-					  }
+					  // Counted by monitor_modbus(), the port has already been reset
 					  break;
 				  }
 				  case MB_FATAL_ERROR:
@@ -278,7 +448,7 @@ int main(void)
 					  }
 					  if(modbus_status != 0)
 					  {
-						  holding_register_database[MB_ERRORS] |= 1U << ((modbus_status) + (MB_FATAL_ERROR - RANGE_ERROR));
+						  handle_modbus_error(modbus_status);
 					  }
 					  break;
 				  }
@@ -293,6 +463,13 @@ int main(void)
 	  {
 		  if(!shutdown)
 		  {
+			  journal_log(JOURNAL_MANUAL, 1, 0);
+
+			  // The watchdog is meaningless while the board is held in manual mode
+			  timer_stop(TIMER_WDG);
+			  timer_stop(TIMER_MB_SCHEDULE);
+			  sync_cancel();
+
 			  // Shutdown the Modbus
 			  int8_t status = modbus_shutdown();
 			  if(status != 0)
@@ -300,15 +477,29 @@ int main(void)
 				  // log error in a queue
 			  }
 
-			  // Set all GPIO pins high
-			  HAL_GPIO_WritePin(RELAY_120_GPIO_Port, RELAY_120_Pin, GPIO_PIN_SET);
-			  HAL_Delay(1000);
-			  HAL_GPIO_WritePin(RELAY_480_GPIO_Port, RELAY_480_Pin, GPIO_PIN_SET);
+			  // Set all GPIO pins high, the operator is at the board so the fleet stagger does not apply
+			  relay_sequence_start(RELAY_120_MASK | RELAY_480_MASK, 0);
 
 			  // Ensure this code only executes once
 			  shutdown = 1;
 		  }
 	  }
+	  relay_sequence_service();
+	  journal_service();
+	  ram_service();
+	  if(!shutdown)
+	  {
+		  telemetry_service();
+	  }
+
+	  // Sleep until the next interrupt if nothing arrived while this iteration was running
+	  load_busy_end();
+	  __disable_irq();
+	  if(!work_pending())
+	  {
+		  idle_enter(holding_register_database[IDLE_MODE], (modbus_bus_idle() && telemetry_idle()) || shutdown);
+	  }
+	  __enable_irq();
     /* USER CODE END WHILE */
 
     /* USER CODE BEGIN 3 */
@@ -328,8 +519,11 @@ void SystemClock_Config(void)
   /** Initializes the RCC Oscillators according to the specified parameters
   * in the RCC_OscInitTypeDef structure.
   */
-  RCC_OscInitStruct.OscillatorType = RCC_OSCILLATORTYPE_HSE;
+  RCC_OscInitStruct.OscillatorType = RCC_OSCILLATORTYPE_HSI|RCC_OSCILLATORTYPE_HSE;
   RCC_OscInitStruct.HSEState = RCC_HSE_ON;
+  RCC_OscInitStruct.HSIState = RCC_HSI_ON;
+  RCC_OscInitStruct.HSIDiv = RCC_HSI_DIV4;
+  RCC_OscInitStruct.HSICalibrationValue = RCC_HSICALIBRATION_DEFAULT;
   if (HAL_RCC_OscConfig(&RCC_OscInitStruct) != HAL_OK)
   {
     Error_Handler();
@@ -398,6 +592,100 @@ static void MX_USART1_UART_Init(void)
 
 }
 
+/**
+  * @brief USART2 Initialization Function
+  * @param None
+  * @retval None
+  */
+static void MX_USART2_UART_Init(void)
+{
+
+  /* USER CODE BEGIN USART2_Init 0 */
+
+  /* USER CODE END USART2_Init 0 */
+
+  /* USER CODE BEGIN USART2_Init 1 */
+
+  /* USER CODE END USART2_Init 1 */
+  huart2.Instance = USART2;
+  huart2.Init.BaudRate = 9600;
+  huart2.Init.WordLength = UART_WORDLENGTH_8B;
+  huart2.Init.StopBits = UART_STOPBITS_1;
+  huart2.Init.Parity = UART_PARITY_NONE;
+  huart2.Init.Mode = UART_MODE_TX_RX;
+  huart2.Init.HwFlowCtl = UART_HWCONTROL_NONE;
+  huart2.Init.OverSampling = UART_OVERSAMPLING_16;
+  huart2.Init.OneBitSampling = UART_ONE_BIT_SAMPLE_DISABLE;
+  huart2.Init.ClockPrescaler = UART_PRESCALER_DIV1;
+  huart2.AdvancedInit.AdvFeatureInit = UART_ADVFEATURE_NO_INIT;
+  if (HAL_RS485Ex_Init(&huart2, UART_DE_POLARITY_HIGH, 0, 0) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  /* USER CODE BEGIN USART2_Init 2 */
+
+  /* USER CODE END USART2_Init 2 */
+
+}
+
+/**
+  * @brief TIM2 Initialization Function
+  * @param None
+  * @retval None
+  */
+static void MX_TIM2_Init(void)
+{
+
+  /* USER CODE BEGIN TIM2_Init 0 */
+
+  /* USER CODE END TIM2_Init 0 */
+
+  TIM_ClockConfigTypeDef sClockSourceConfig = {0};
+  TIM_MasterConfigTypeDef sMasterConfig = {0};
+  TIM_OC_InitTypeDef sConfigOC = {0};
+
+  /* USER CODE BEGIN TIM2_Init 1 */
+
+  /* USER CODE END TIM2_Init 1 */
+  htim2.Instance = TIM2;
+  htim2.Init.Prescaler = 7;
+  htim2.Init.CounterMode = TIM_COUNTERMODE_UP;
+  htim2.Init.Period = 4294967295;
+  htim2.Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
+  htim2.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_DISABLE;
+  if (HAL_TIM_Base_Init(&htim2) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  sClockSourceConfig.ClockSource = TIM_CLOCKSOURCE_INTERNAL;
+  if (HAL_TIM_ConfigClockSource(&htim2, &sClockSourceConfig) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  if (HAL_TIM_OC_Init(&htim2) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  sMasterConfig.MasterOutputTrigger = TIM_TRGO_RESET;
+  sMasterConfig.MasterSlaveMode = TIM_MASTERSLAVEMODE_DISABLE;
+  if (HAL_TIMEx_MasterConfigSynchronization(&htim2, &sMasterConfig) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  sConfigOC.OCMode = TIM_OCMODE_TIMING;
+  sConfigOC.Pulse = 0;
+  sConfigOC.OCPolarity = TIM_OCPOLARITY_HIGH;
+  sConfigOC.OCFastMode = TIM_OCFAST_DISABLE;
+  if (HAL_TIM_OC_ConfigChannel(&htim2, &sConfigOC, TIM_CHANNEL_1) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  /* USER CODE BEGIN TIM2_Init 2 */
+
+  /* USER CODE END TIM2_Init 2 */
+
+}
+
 /**
   * Enable DMA controller clock
   */
@@ -414,6 +702,9 @@ static void MX_DMA_Init(void)
   /* DMA1_Channel2_3_IRQn interrupt configuration */
   HAL_NVIC_SetPriority(DMA1_Channel2_3_IRQn, 0, 0);
   HAL_NVIC_EnableIRQ(DMA1_Channel2_3_IRQn);
+  /* DMAMUX1_DMA1_CH4_5_IRQn interrupt configuration */
+  HAL_NVIC_SetPriority(DMAMUX1_DMA1_CH4_5_IRQn, 0, 0);
+  HAL_NVIC_EnableIRQ(DMAMUX1_DMA1_CH4_5_IRQn);
 
 }
 
@@ -439,13 +730,13 @@ static void MX_GPIO_Init(void)
 
   /*Configure GPIO pins : SENSE_120_Pin ESTOP_SENSE_Pin */
   GPIO_InitStruct.Pin = SENSE_120_Pin|ESTOP_SENSE_Pin;
-  GPIO_InitStruct.Mode = GPIO_MODE_INPUT;
+  GPIO_InitStruct.Mode = GPIO_MODE_IT_RISING_FALLING;
   GPIO_InitStruct.Pull = GPIO_NOPULL;
   HAL_GPIO_Init(GPIOB, &GPIO_InitStruct);
 
   /*Configure GPIO pin : MANUAL_Pin */
   GPIO_InitStruct.Pin = MANUAL_Pin;
-  GPIO_InitStruct.Mode = GPIO_MODE_INPUT;
+  GPIO_InitStruct.Mode = GPIO_MODE_IT_RISING_FALLING;
   GPIO_InitStruct.Pull = GPIO_PULLUP;
   HAL_GPIO_Init(MANUAL_GPIO_Port, &GPIO_InitStruct);
 
@@ -456,12 +747,215 @@ static void MX_GPIO_Init(void)
   GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_LOW;
   HAL_GPIO_Init(GPIOB, &GPIO_InitStruct);
 
+  /* EXTI interrupt init*/
+  HAL_NVIC_SetPriority(EXTI4_15_IRQn, 0, 0);
+  HAL_NVIC_EnableIRQ(EXTI4_15_IRQn);
+
 /* USER CODE BEGIN MX_GPIO_Init_2 */
 /* USER CODE END MX_GPIO_Init_2 */
 }
 
 /* USER CODE BEGIN 4 */
+void feed_watchdog()
+{
+	timer_start(TIMER_WDG, holding_register_database[WDG_TIMEOUT], NULL);
+}
 
+/*
+ * Feed the watchdog for a frame received on port, if that port's bit is set in WDG_PORTS
+ */
+void feed_watchdog_port(uint8_t port)
+{
+	if(holding_register_database[WDG_PORTS] & (1U << port))
+	{
+		feed_watchdog();
+	}
+}
+
+/*
+ * Energise the relays in a fixed order without blocking the super-loop
+ * After this board's stagger delay (if stagger is set) the 120VAC relay is driven, then the 480VAC relay once
+ * RELAY_SEQUENCE_DELAY has elapsed
+ */
+void relay_sequence_start(uint8_t gpio_state, uint8_t stagger)
+{
+	relay_sequence_state = gpio_state;
+	uint32_t delay = stagger ? relay_stagger_delay() : 0;
+	if(delay > 0)
+	{
+		relay_sequence_stage = RELAY_STAGE_STAGGER;
+		timer_start(TIMER_RELAY_SEQUENCE, delay, NULL);
+	}
+	else
+	{
+		relay_sequence_energise();
+	}
+}
+
+void relay_sequence_service()
+{
+	if(timer_expired(TIMER_RELAY_SEQUENCE))
+	{
+		if(relay_sequence_stage == RELAY_STAGE_STAGGER)
+		{
+			relay_sequence_energise();
+		}
+		else if((relay_sequence_state & RELAY_480_MASK) != 0)
+		{
+			HAL_GPIO_WritePin(RELAY_480_GPIO_Port, RELAY_480_Pin, GPIO_PIN_SET);
+		}
+	}
+}
+
+void relay_sequence_energise()
+{
+	if((relay_sequence_state & RELAY_120_MASK) != 0)
+	{
+		HAL_GPIO_WritePin(RELAY_120_GPIO_Port, RELAY_120_Pin, GPIO_PIN_SET);
+	}
+	relay_sequence_stage = RELAY_STAGE_480;
+	timer_start(TIMER_RELAY_SEQUENCE, RELAY_SEQUENCE_DELAY, NULL);
+}
+
+/*
+ * Delay in ms before this board starts its relay sequence
+ */
+uint32_t relay_stagger_delay()
+{
+	uint32_t slot = 0;
+	switch(holding_register_database[RELAY_STAGGER_MODE])
+	{
+		case STAGGER_MODBUS_ID:
+		{
+			slot = holding_register_database[MODBUS_ID];
+			break;
+		}
+		case STAGGER_UID:
+		{
+			// Fold the 96 bit UID, the wafer coordinates in the first word vary the most between boards
+			const uint32_t *uid = (const uint32_t *)UID_BASE;
+			slot = uid[0] ^ uid[1] ^ uid[2];
+			slot ^= slot >> 16;
+			slot ^= slot >> 8;
+			break;
+		}
+		case STAGGER_SLOT:
+		{
+			slot = holding_register_database[RELAY_STAGGER_SLOT];
+			break;
+		}
+		default:
+		{
+			return 0;
+		}
+	}
+	return (slot % holding_register_database[RELAY_STAGGER_SLOTS]) * holding_register_database[RELAY_STAGGER_STEP];
+}
+
+/*
+ * Treat a page from another layout as erased, so every restore function keeps its defaults and the relays stay off
+ */
+void ee_validate()
+{
+	if(ee.layout != EE_LAYOUT)
+	{
+		memset(&ee, 0xFF, sizeof(ee));
+		ee.gpio_state = 0;
+		ee.layout = EE_LAYOUT;
+	}
+	ee.gpio_state &= (RELAY_120_MASK | RELAY_480_MASK);
+}
+
+/*
+ * Load the stagger policy from the emulated EEPROM, an erased page keeps the defaults
+ */
+void relay_stagger_restore()
+{
+	if(ee.stagger_mode < NUM_STAGGER_MODES && ee.stagger_slots >= 1)
+	{
+		holding_register_database[RELAY_STAGGER_MODE] = ee.stagger_mode;
+		holding_register_database[RELAY_STAGGER_SLOT] = ee.stagger_slot;
+		holding_register_database[RELAY_STAGGER_SLOTS] = ee.stagger_slots;
+		holding_register_database[RELAY_STAGGER_STEP] = ee.stagger_step;
+	}
+}
+
+void relay_stagger_store()
+{
+	if(ee.stagger_mode != holding_register_database[RELAY_STAGGER_MODE] ||
+	   ee.stagger_slot != holding_register_database[RELAY_STAGGER_SLOT] ||
+	   ee.stagger_slots != holding_register_database[RELAY_STAGGER_SLOTS] ||
+	   ee.stagger_step != holding_register_database[RELAY_STAGGER_STEP])
+	{
+		ee.stagger_mode = holding_register_database[RELAY_STAGGER_MODE];
+		ee.stagger_slot = holding_register_database[RELAY_STAGGER_SLOT];
+		ee.stagger_slots = holding_register_database[RELAY_STAGGER_SLOTS];
+		ee.stagger_step = holding_register_database[RELAY_STAGGER_STEP];
+		EE_Write();
+	}
+}
+/*
+ * Returns 1 if an interrupt has left work for the super-loop
+ */
+uint8_t work_pending()
+{
+	return modbus_work_pending() || timer_pending() || gpio_event;
+}
+
+void refresh_input_registers()
+{
+	input_register_database[SLEEP_COUNT_HIGH] = (idle_stats.sleep_count >> 16) & 0xFFFF;
+	input_register_database[SLEEP_COUNT_LOW] = idle_stats.sleep_count & 0xFFFF;
+	input_register_database[STOP_COUNT_HIGH] = (idle_stats.stop_count >> 16) & 0xFFFF;
+	input_register_database[STOP_COUNT_LOW] = idle_stats.stop_count & 0xFFFF;
+	input_register_database[SLEEP_TIME_HIGH] = (idle_stats.sleep_time_ms >> 16) & 0xFFFF;
+	input_register_database[SLEEP_TIME_LOW] = idle_stats.sleep_time_ms & 0xFFFF;
+	input_register_database[WAKE_LATENCY] = idle_stats.wake_latency;
+	input_register_database[WAKE_LATENCY_MAX] = idle_stats.wake_latency_max;
+	input_register_database[SYSCLK_KHZ] = HAL_RCC_GetSysClockFreq() / 1000;
+	input_register_database[MB_BAUD_ACTUAL_HIGH] = (modbus_get_actual_baud_rate() >> 16) & 0xFFFF;
+	input_register_database[MB_BAUD_ACTUAL_LOW] = modbus_get_actual_baud_rate() & 0xFFFF;
+	input_register_database[MB_BAUD_ERROR] = (uint16_t)((int16_t)modbus_get_baud_rate_error()); // ppm, two's complement
+	input_register_database[MB_FRAME_COUNT_HIGH] = (modbus_stats[MODBUS_PORT_1].frames >> 16) & 0xFFFF;
+	input_register_database[MB_FRAME_COUNT_LOW] = modbus_stats[MODBUS_PORT_1].frames & 0xFFFF;
+	input_register_database[MB_OVERRUN_COUNT_HIGH] = (modbus_stats[MODBUS_PORT_1].overruns >> 16) & 0xFFFF;
+	input_register_database[MB_OVERRUN_COUNT_LOW] = modbus_stats[MODBUS_PORT_1].overruns & 0xFFFF;
+	input_register_database[MB_IRQ_PER_FRAME] = modbus_stats[MODBUS_PORT_1].irq_per_frame;
+	input_register_database[MB_IRQ_PER_FRAME_MAX] = modbus_stats[MODBUS_PORT_1].irq_per_frame_max;
+	input_register_database[MB_FILTERED_COUNT_HIGH] = (modbus_stats[MODBUS_PORT_1].filtered >> 16) & 0xFFFF;
+	input_register_database[MB_FILTERED_COUNT_LOW] = modbus_stats[MODBUS_PORT_1].filtered & 0xFFFF;
+	input_register_database[SYNC_STATE] = sync_get_state();
+	input_register_database[SYNC_TIME_HIGH] = (sync_bus_time() >> 16) & 0xFFFF;
+	input_register_database[SYNC_TIME_LOW] = sync_bus_time() & 0xFFFF;
+	input_register_database[SCHEDULE_SKEW] = sync_stats.skew;
+	input_register_database[SCHEDULE_SKEW_MAX] = sync_stats.skew_max;
+	input_register_database[MB2_FRAME_COUNT_HIGH] = (modbus_stats[MODBUS_PORT_2].frames >> 16) & 0xFFFF;
+	input_register_database[MB2_FRAME_COUNT_LOW] = modbus_stats[MODBUS_PORT_2].frames & 0xFFFF;
+	input_register_database[MB2_OVERRUN_COUNT_HIGH] = (modbus_stats[MODBUS_PORT_2].overruns >> 16) & 0xFFFF;
+	input_register_database[MB2_OVERRUN_COUNT_LOW] = modbus_stats[MODBUS_PORT_2].overruns & 0xFFFF;
+	input_register_database[MB2_FILTERED_COUNT_HIGH] = (modbus_stats[MODBUS_PORT_2].filtered >> 16) & 0xFFFF;
+	input_register_database[MB2_FILTERED_COUNT_LOW] = modbus_stats[MODBUS_PORT_2].filtered & 0xFFFF;
+	input_register_database[TELEMETRY_COUNT_HIGH] = (telemetry_stats.records >> 16) & 0xFFFF;
+	input_register_database[TELEMETRY_COUNT_LOW] = telemetry_stats.records & 0xFFFF;
+	input_register_database[TELEMETRY_OVERRUNS] = telemetry_stats.overruns;
+	latency_export(&input_register_database[LATENCY_START]);
+	diag_export(&input_register_database[ERROR_COUNT_START]);
+	load_export(&input_register_database[LOAD_START]);
+	ram_export(&input_register_database[RAM_START]);
+	fault_export(&input_register_database[FAULT_START]);
+}
+
+void HAL_GPIO_EXTI_Rising_Callback(uint16_t GPIO_Pin)
+{
+	gpio_event = 1;
+	telemetry_edge();
+}
+
+void HAL_GPIO_EXTI_Falling_Callback(uint16_t GPIO_Pin)
+{
+	gpio_event = 1;
+	telemetry_edge();
+}
 /* USER CODE END 4 */
 
 /**
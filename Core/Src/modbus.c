@@ -9,6 +9,17 @@
 #include "modbus.h"
 #include "error_codes.h"
 #include "main.h"
+#include "timer.h"
+#include "idle.h"
+#include "clock.h"
+#include "ee.h"
+#include "sync.h"
+#include "telemetry.h"
+#include "latency.h"
+#include "diag.h"
+#include "trace.h"
+#include "journal.h"
+#include "profile.h"
 #include <stdint.h>
 #include <string.h>
 
@@ -16,45 +27,264 @@
 #define TX_BUFFER_SIZE  RX_BUFFER_SIZE
 #define MODBUS_TX_BUFFER_SIZE 256
 #define MODBUS_RX_BUFFER_SIZE  256
+#define MODBUS_CHUNK_TIMEOUT 10 // ms allowed between the header and the body of a message
+#define MODBUS_RX_FIFO_THRESHOLD UART_RXFIFO_THRESHOLD_1_2 // Leaves 4 characters of slack for the interrupt latency
+#define MODBUS_RX_FIFO_CHARS 4 // Characters received by the time the threshold interrupt fires
+#define MODBUS_HEADER_CHARS 6
+#define MODBUS_TX_FIFO_THRESHOLD UART_TXFIFO_THRESHOLD_1_8 // The TX DMA is requested whenever the FIFO is not full
+#define MODBUS_RECEIVER_TIMEOUT 35 // bit times, 3.5 characters of silence end a frame
+#define USARTDIV_MIN 0x10
+#define USARTDIV_MAX 0xFFFF
+#define MODBUS_FRAME_GAP_MIN 1750 // us, the fixed inter-frame gap above 19200 baud
+#define MODBUS_QUEUE_IDLE 0xFF
 #define high_byte(value) ((value >> 8) & 0xFF)
 #define low_byte(value) (value & 0xFF)
 
-// Buffer variables
-uint8_t modbus_rx_buffer[MODBUS_RX_BUFFER_SIZE];
-uint8_t modbus_tx_buffer[MODBUS_TX_BUFFER_SIZE];
+#ifdef MB_SLAVE
+#define MODBUS_PORT_1_ROLE MODBUS_ROLE_SLAVE
+#else
+#define MODBUS_PORT_1_ROLE MODBUS_ROLE_MASTER
+#endif
+
+// External Variables
+extern UART_HandleTypeDef huart1;
+extern UART_HandleTypeDef huart2;
+extern uint16_t holding_register_database[];
+extern uint16_t input_register_database[];
+extern ee_storage_t ee;
+
 #ifdef MB_MASTER
 uint16_t tx_buffer[TX_BUFFER_SIZE];
 uint16_t response_buffer[RX_BUFFER_SIZE];
 
-// Master Response variables
-uint8_t target_id = 0;
-uint8_t target_function_code = 0;
-uint16_t expected_rx_len = 0;
-uint8_t response_rx = 0;
-
 // Timing Variables
-uint32_t rx_time = 0;
 uint32_t response_interval = 1000;
+
+// Transaction queue variables
+typedef struct modbus_queued_s
+{
+	modbus_transaction_t transaction;
+	uint8_t attempts;
+	uint8_t schedule_slot; // MODBUS_QUEUE_IDLE for a transaction queued by the application
+}modbus_queued_t;
+
+typedef struct modbus_scheduled_s
+{
+	modbus_transaction_t transaction;
+	uint16_t interval; // ms, 0 leaves the slot unused
+	uint8_t queued;
+	uint32_t due; // TIM2 count
+}modbus_scheduled_t;
+
+static modbus_queued_t queue[MODBUS_QUEUE_SIZE];
+static uint8_t queue_head = 0;
+static uint8_t queue_count = 0;
+static uint8_t queue_active = 0; // The transaction at the head is on the bus
+static modbus_scheduled_t schedule[MODBUS_SCHEDULE_SIZE];
 #endif // MB_MASTER
-uint32_t tx_time = 0;
-volatile uint32_t chunk_time = 0;
 
-// Interrupt Handling Variables
-volatile uint16_t modbus_header = 1;
-volatile uint8_t uart_rx_int = 0;
-volatile uint8_t uart_tx_int = 1;
-volatile uint8_t uart_err_int = 0;
+// Baud rate switch variables
+typedef enum baud_switch_e
+{
+	BAUD_SWITCH_IDLE,
+	BAUD_SWITCH_PENDING, // Waiting for the acknowledgement to leave at the old rate
+	BAUD_SWITCH_PROBATION // Running at the new rate, waiting for a valid frame before committing it
+}baud_switch_t;
 
-// External Variables
-extern UART_HandleTypeDef huart1;
-extern DMA_HandleTypeDef hdma_usart1_rx;
-extern DMA_HandleTypeDef hdma_usart1_tx;
-extern uint16_t holding_register_database[];
+uint8_t baud_switch_state = BAUD_SWITCH_IDLE;
+uint32_t previous_baud_rate = 9600;
+
+// Enumeration variables
+uint8_t enumerated = 0; // Set once an ID has been assigned by UID, the board then stays out of searches
+
+// Auto-baud variables
+uint8_t auto_baud_pending = 0;
+uint8_t auto_baud_active = 0;
+uint8_t consecutive_rx_errors = 0;
+
+// Baud rate generator variables
+typedef struct baud_config_s
+{
+	uint32_t over_sampling;
+	uint32_t prescaler;
+	uint32_t actual_baud_rate;
+	int32_t error; // ppm
+}baud_config_t;
+
+// Progress of a slave response through the latency timestamps
+typedef enum latency_state_e
+{
+	LATENCY_STATE_IDLE,
+	LATENCY_STATE_SENDING, // modbus_send() has been called
+	LATENCY_STATE_SENT // TX complete, waiting for monitor_modbus() to record it
+}latency_state_t;
+
+// Diagnostic counters, in the order of their function code 0x08 sub-functions
+typedef enum modbus_counter_e
+{
+	MB_COUNT_BUS_MESSAGE,
+	MB_COUNT_BUS_ERROR,
+	MB_COUNT_EXCEPTION,
+	MB_COUNT_SLAVE_MESSAGE,
+	MB_COUNT_NO_RESPONSE,
+	MB_COUNT_NAK,
+	MB_COUNT_BUSY,
+	MB_COUNT_OVERRUN,
+	NUM_MODBUS_COUNTERS
+}modbus_counter_t;
+
+static const uint32_t baud_rate_table[NUM_BAUD_RATES] = {
+	0, // BAUD_RATE_CUSTOM
+	2400, 4800, 9600, 19200, 38400, 57600, 115200, 128000, 256000,
+	460800, 921600, 1000000, 2000000, 3000000
+};
+
+/*
+ * Transport state of one USART
+ * Port 1 carries the auto-baud, baud rate switch and address filtering features, which rely on USART1 only hardware
+ * or on the MB_BAUD registers. USART2 has no FIFO, so it always receives through the header / body DMA path
+ */
+typedef struct modbus_port_s
+{
+	UART_HandleTypeDef *huart;
+	uint8_t role;
+	uint8_t fifo_rx; // Frames are drained from the FIFO and closed by the receiver timeout
+	timer_id_t tx_timer;
+	timer_id_t chunk_timer;
+	timer_id_t turnaround_timer;
+	timer_id_t rx_timer;
+	baud_config_t baud_config;
+
+	// Buffer variables
+	uint8_t rx_buffer[MODBUS_RX_BUFFER_SIZE];
+	uint8_t tx_buffer[MODBUS_TX_BUFFER_SIZE];
+	uint8_t tx_pending_len;
+
+	// Interrupt Handling Variables
+	volatile uint16_t header;
+	volatile uint8_t rx_int;
+	volatile uint8_t tx_int;
+	volatile uint8_t err_int;
+	volatile uint16_t irq_count;
+	volatile uint16_t rx_frame_len;
+	volatile uint32_t rx_frame_time; // TIM2 count when the last frame completed
+	volatile uint32_t idle_since; // TIM2 count when the bus last went quiet
+	volatile uint16_t rx_index;
+	volatile uint8_t rx_discard;
+
+	// Latency of the request being served, see latency.h
+	uint16_t char_time; // us per character at the current baud rate
+	volatile uint32_t rx_start_time;
+	volatile uint8_t latency_state;
+	uint8_t latency_function_code;
+	uint32_t latency_time[NUM_LATENCY_EVENTS];
+
+	// Diagnostics, see modbus.h
+	volatile uint16_t counter[NUM_MODBUS_COUNTERS];
+	uint8_t response_due; // The last frame addressed to this board has not been answered yet
+	trace_entry_t trace; // The frame being served, see trace.h
+	uint8_t trace_pending;
+	uint8_t fatal_logged; // A failed reset has been journaled, cleared once the port resets cleanly
+	uint8_t clock_stale; // PCLK changed while the port was busy, its baud rate is recalculated once it is quiet
+
+#ifdef MB_MASTER
+	// Master Response variables
+	uint8_t target_id;
+	uint8_t target_function_code;
+	uint16_t expected_rx_len;
+	uint8_t response_rx;
+	int8_t result; // Outcome of the last request
+#endif
+}modbus_port_t;
+
+modbus_port_t modbus_ports[NUM_MODBUS_PORTS] = {
+	[MODBUS_PORT_1] = {
+		.huart = &huart1,
+		.role = MODBUS_PORT_1_ROLE,
+#ifdef MB_FIFO_MODE
+		.fifo_rx = 1,
+#endif
+		.tx_timer = TIMER_MB_TX,
+		.chunk_timer = TIMER_MB_CHUNK,
+		.turnaround_timer = TIMER_MB_TURNAROUND,
+		.rx_timer = TIMER_MB_RX,
+		.baud_config = {UART_OVERSAMPLING_16, UART_PRESCALER_DIV1, 9600, 0},
+		.header = 1,
+		.tx_int = 1
+	},
+	[MODBUS_PORT_2] = {
+		.huart = &huart2,
+		.role = MODBUS_PORT_2_DEFAULT_ROLE,
+		.tx_timer = TIMER_MB2_TX,
+		.chunk_timer = TIMER_MB2_CHUNK,
+		.turnaround_timer = TIMER_MB2_TURNAROUND,
+		.rx_timer = TIMER_MB2_RX,
+		.baud_config = {UART_OVERSAMPLING_16, UART_PRESCALER_DIV1, 9600, 0},
+		.header = 1,
+		.tx_int = 1
+	}
+};
+
+modbus_port_t *const primary_port = &modbus_ports[MODBUS_PORT_1];
+modbus_port_t *active_port = &modbus_ports[MODBUS_PORT_1]; // Port of the frame being served by the slave API
+#ifdef MB_MASTER
+modbus_port_t *const master_port = &modbus_ports[MODBUS_MASTER_PORT];
+#endif
+
+modbus_stats_t modbus_stats[NUM_MODBUS_PORTS] = {0};
+uint16_t port_2_baud_rate = 0xFFFF; // MB2_BAUD_RATE last applied to USART2
 
 // Private Functions
-uint16_t crc_16(uint8_t *data, uint8_t size);
-int8_t handle_chunk_miss();
+int8_t handle_chunk_miss(modbus_port_t *port);
 void handle_range(uint16_t holding_register);
+int8_t return_registers(uint16_t *register_database, uint16_t num_database_registers, uint8_t *tx_len);
+modbus_port_t *modbus_port_lookup(UART_HandleTypeDef *huart);
+int8_t modbus_port_send(modbus_port_t *port, uint8_t size);
+int8_t modbus_port_send_delayed(modbus_port_t *port, uint8_t size, uint32_t delay_us);
+int8_t modbus_port_set_rx(modbus_port_t *port);
+int8_t modbus_port_reset(modbus_port_t *port);
+int8_t modbus_port_set_baud_rate(modbus_port_t *port, uint32_t baud_rate, const baud_config_t *config);
+int8_t monitor_port(modbus_port_t *port);
+void monitor_port_config();
+uint8_t modbus_port_2_role_valid(uint8_t role);
+uint8_t modbus_port_quiet(modbus_port_t *port);
+int8_t modbus_port_reclock(modbus_port_t *port);
+int8_t modbus_start_tx(modbus_port_t *port, uint8_t len);
+uint32_t modbus_kernel_clock(modbus_port_t *port);
+int8_t modbus_find_baud_config(uint32_t baud_rate, uint32_t kernel_clock, baud_config_t *config);
+void handle_baud_rate_range(uint16_t first_register_address, uint16_t last_register_address);
+uint8_t modbus_crc_valid();
+void modbus_rx_error();
+int8_t modbus_auto_baud_lock();
+int8_t modbus_baud_switch_commit();
+int8_t monitor_baud_switch();
+void modbus_frame_start(modbus_port_t *port, uint8_t chars);
+uint32_t modbus_request_body(const uint8_t *header);
+uint8_t modbus_accept_frame(modbus_port_t *port, uint8_t address);
+uint8_t modbus_group_match(uint8_t address);
+void modbus_filter_frame(modbus_port_t *port, uint8_t in_progress);
+int8_t modbus_store_address();
+uint8_t modbus_uid_bit(const uint8_t *uid, uint8_t bit);
+uint32_t modbus_enumerate_slot();
+void modbus_frame_complete(modbus_port_t *port, uint16_t len);
+int8_t modbus_configure_fifo(modbus_port_t *port);
+void modbus_record_latency(modbus_port_t *port);
+void modbus_clear_counters(modbus_port_t *port);
+void modbus_trace_start(modbus_port_t *port, uint8_t result);
+void modbus_trace_commit(modbus_port_t *port, uint16_t response_time);
+#ifdef MB_FIFO_MODE
+void modbus_fifo_rx(modbus_port_t *port);
+#endif
+#ifdef MB_MASTER
+uint8_t modbus_build_request(uint8_t id, uint8_t function_code, uint16_t address, uint16_t quantity, const uint16_t *data);
+int8_t modbus_master_transmit(uint8_t size, uint8_t id, uint8_t function_code, uint16_t expected_rx_len, uint32_t timeout);
+uint32_t modbus_frame_gap(modbus_port_t *port);
+void modbus_queue_service();
+int8_t modbus_queue_issue();
+void modbus_queue_complete();
+void modbus_queue_flush();
+void store_rx_buffer();
+#endif
 
 /* Table of CRC values for high-order byte */
 static const uint8_t table_crc_hi[] = {
@@ -121,42 +351,137 @@ static const uint8_t table_crc_lo[] = {
  */
 void HAL_UARTEx_RxEventCallback(UART_HandleTypeDef *huart, uint16_t Size)
 {
-	if(modbus_header)
+	modbus_port_t *port = modbus_port_lookup(huart);
+	if(port == NULL)
+	{
+		return;
+	}
+
+	if(port->header)
 	{
-		// Log the time for chunk miss error handling
-		chunk_time = HAL_GetTick();
-		modbus_header = 0;
+#ifdef MB_SLAVE
+		if(port->role == MODBUS_ROLE_SLAVE && Size == 0)
+		{
+			// A bare idle line (noise, or the end of a frame skipped in mute mode) carries no frame, listen again
+			modbus_port_set_rx(port);
+			return;
+		}
+		// Frames for other boards are dropped here, before the body is ever transferred
+		// The header of every frame on the bus is still moved by the DMA: Modbus RTU has no address mark, so mute mode
+		// can only be entered once the address has been seen, which saves the body transfer and the wake-up of main()
+		if(port->role == MODBUS_ROLE_SLAVE && !modbus_accept_frame(port, port->rx_buffer[0]))
+		{
+			modbus_filter_frame(port, HAL_UARTEx_GetRxEventType(huart) == HAL_UART_RXEVENT_TC);
+			return;
+		}
+#endif
+#ifdef MB_MASTER
+		if(port->role == MODBUS_ROLE_MASTER)
+		{
+			// An exception response is shorter than the header, the idle line has already ended it
+			if(HAL_UARTEx_GetRxEventType(huart) != HAL_UART_RXEVENT_TC)
+			{
+				if(Size > 0)
+				{
+					modbus_frame_complete(port, Size);
+				}
+				else
+				{
+					modbus_port_set_rx(port);
+				}
+				return;
+			}
+			modbus_frame_start(port, MODBUS_HEADER_CHARS);
+
+			// The response length is known from the request, + 1 in the event that the slave sends more than expected
+			uint16_t body = (port->expected_rx_len > 6) ? (port->expected_rx_len - 6 + 1) : 1;
+			HAL_UARTEx_ReceiveToIdle_DMA(huart, &port->rx_buffer[6], body);
+			__HAL_DMA_DISABLE_IT(huart->hdmarx, DMA_IT_HT);
+			return;
+		}
+#endif
+		modbus_frame_start(port, MODBUS_HEADER_CHARS);
 
-		// Setup the DMA to receive the # message bytes + crc + 1 in the event that the # bytes is in the message
-		HAL_UARTEx_ReceiveToIdle_DMA(&huart1, &modbus_rx_buffer[6], (uint16_t)(((modbus_rx_buffer[4] << 8) | modbus_rx_buffer[5])*2 + 2 + 1));
-		__HAL_DMA_DISABLE_IT(huart1.hdmarx, DMA_IT_HT);
+		HAL_UARTEx_ReceiveToIdle_DMA(huart, &port->rx_buffer[6], modbus_request_body(port->rx_buffer));
+		__HAL_DMA_DISABLE_IT(huart->hdmarx, DMA_IT_HT);
 	}
 	else
 	{
-		/*
-		 * This is where the message officially completes being received
-		 * For Masters: Don't set up a reception, modbus stays in idle until you transmit a command again
-		 * For Slaves: Don't set up reception since you will need to transmit a response first
-		 * Use modbus_set_rx(); as the user to re-enable receive mode
-		 */
-		modbus_header = 1;
-		uart_rx_int = 1;
+		modbus_frame_complete(port, 6 + Size);
 #ifdef MB_SLAVE
-		HAL_UARTEx_ReceiveToIdle_DMA(&huart1, modbus_rx_buffer, 6);
-		__HAL_DMA_DISABLE_IT(huart1.hdmarx, DMA_IT_HT);
+		if(port->role == MODBUS_ROLE_SLAVE)
+		{
+			HAL_UARTEx_ReceiveToIdle_DMA(huart, port->rx_buffer, 6);
+			__HAL_DMA_DISABLE_IT(huart->hdmarx, DMA_IT_HT);
+		}
+#endif
+	}
+}
+
+/*
+ * USART interrupt hook, runs ahead of HAL_UART_IRQHandler
+ * In FIFO mode the receive path is serviced here, the HAL handler is left with transmission and errors
+ */
+void modbus_irq_handler(UART_HandleTypeDef *huart)
+{
+	modbus_port_t *port = modbus_port_lookup(huart);
+	if(port == NULL)
+	{
+		return;
+	}
+
+	port->irq_count++;
+	if(__HAL_UART_GET_FLAG(huart, UART_FLAG_ORE))
+	{
+		modbus_stats[port - modbus_ports].overruns++;
+		port->counter[MB_COUNT_OVERRUN]++;
+	}
+#ifdef MB_FIFO_MODE
+	if(port->fifo_rx)
+	{
+		modbus_fifo_rx(port);
+	}
 #endif
+}
+
+/*
+ * Receive DMA interrupt hook
+ */
+void modbus_count_irq(UART_HandleTypeDef *huart)
+{
+	modbus_port_t *port = modbus_port_lookup(huart);
+	if(port != NULL)
+	{
+		port->irq_count++;
 	}
 }
 
 void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart)
 {
-	uart_tx_int = 1;
+	modbus_port_t *port = modbus_port_lookup(huart);
+	if(port == NULL)
+	{
+		return;
+	}
+	timer_stop(port->tx_timer);
+	port->idle_since = timer_now();
+	port->tx_int = 1;
+	if(port->latency_state == LATENCY_STATE_SENDING)
+	{
+		port->latency_time[LATENCY_TX_COMPLETE] = port->idle_since;
+		port->latency_state = LATENCY_STATE_SENT;
+	}
 }
 
 void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart)
 {
-	uart_err_int = 1;
-	__HAL_UART_DISABLE_IT(&huart1, UART_IT_MASK);
+	modbus_port_t *port = modbus_port_lookup(huart);
+	if(port == NULL)
+	{
+		return;
+	}
+	port->err_int = 1;
+	__HAL_UART_DISABLE_IT(huart, UART_IT_MASK);
 }
 
 
@@ -191,85 +516,58 @@ int8_t read_holding_registers(uint16_t read_address, uint16_t read_quantity, uin
 	{
 		return MB_MEMORY_ERROR;
 	}
-	uint8_t index = 0;
-	modbus_tx_buffer[index++] = id; // Append Modbus ID
-
-	modbus_tx_buffer[index++] = 0x03; // Append Function Code
-	// Append the Read Address (high byte then low byte)
-	modbus_tx_buffer[index++] = high_byte(read_address);
-	modbus_tx_buffer[index++] = low_byte(read_address);
-	// Append the quantity of registers to be read (high byte then low byte)
-	modbus_tx_buffer[index++] = high_byte(read_quantity);
-	modbus_tx_buffer[index++] = low_byte(read_quantity);
+	uint8_t size = modbus_build_request(id, 0x03, read_address, read_quantity, NULL);
+	return modbus_master_transmit(size, id, 0x03, 3 + read_quantity * 2 + 2, response_interval);
+}
 
-	int8_t status = modbus_send(index);
-	if(status != HAL_OK)
+int8_t read_input_registers(uint16_t read_address, uint16_t read_quantity, uint8_t id)
+{
+	if(read_quantity > RX_BUFFER_SIZE)
 	{
-		return status;
+		return MB_MEMORY_ERROR;
 	}
-	// Setup the master to expect a response
-	target_id = id;
-	target_function_code = 0x03;
-	expected_rx_len = 3 + read_quantity * 2 + 2; // This will enable rx timeout monitoring
-	return modbus_set_rx();
+	uint8_t size = modbus_build_request(id, 0x04, read_address, read_quantity, NULL);
+	return modbus_master_transmit(size, id, 0x04, 3 + read_quantity * 2 + 2, response_interval);
 }
 
 int8_t write_multiple_registers(uint16_t write_address, uint16_t write_quantity, uint8_t id)
 {
-	uint8_t index = 0;
-	// Append Modbus ID
-	modbus_tx_buffer[index++] = id;
-	// Append Function
-	modbus_tx_buffer[index++] = 0x10;
-	// Append the Write Address (high byte then low byte)
-	modbus_tx_buffer[index++] = high_byte(write_address);
-	modbus_tx_buffer[index++] = low_byte(write_address);
-	// Append the quantity of registers to be written (high byte then low byte)
-	modbus_tx_buffer[index++] = high_byte(write_quantity);
-	modbus_tx_buffer[index++] = low_byte(write_quantity);
-	// Append the tx_buffer (high byte then low byte
-	for(uint8_t i = 0; i < write_quantity; i++)
+	if(write_quantity > TX_BUFFER_SIZE)
 	{
-		modbus_tx_buffer[index++] = high_byte(tx_buffer[i]);
-		modbus_tx_buffer[index++] = low_byte(tx_buffer[i]);
+		return MB_MEMORY_ERROR;
 	}
+	uint8_t size = modbus_build_request(id, 0x10, write_address, write_quantity, tx_buffer);
 
-	int8_t status = modbus_send(index);
-	if(status != HAL_OK)
-	{
-		return status;
-	}
 	// Wait for a response
-	target_id = id;
-	target_function_code = 0x10;
-	expected_rx_len = 8;
-	return modbus_set_rx();
+	return modbus_master_transmit(size, id, 0x10, 8, response_interval);
 }
 
 int8_t modbus_mic(uint8_t id, uint8_t function_code, uint8_t size)
 {
+	uint8_t *modbus_rx_buffer = master_port->rx_buffer;
+
 	// Check the slave ID
-	if(get_rx_buffer(0) != id)
+	if(modbus_rx_buffer[0] != id)
 	{
 		return handle_modbus_error(MB_SLAVE_ID_MISMATCH);
 	}
 	// Check the function code
-	if((get_rx_buffer(1) & 0x7F) != function_code)
+	if((modbus_rx_buffer[1] & 0x7F) != function_code)
 	{
 		return handle_modbus_error(MB_FUNCTION_MISMATCH);
 	}
 
 	// Check the modbus exception codes within the response if there is some sort of execution error
-	if(((get_rx_buffer(1) >> 7) & 0x01))
+	if(((modbus_rx_buffer[1] >> 7) & 0x01))
 	{
-		return get_rx_buffer(2) + 0x03;
+		return modbus_rx_buffer[2] + 0x03;
 	}
 
 	// Check the CRC
 	if(size >= 5)
 	{
 		uint16_t crc = crc_16(modbus_rx_buffer, size - 2);
-		if((low_byte(crc) != get_rx_buffer(size - 2)) || (high_byte(crc) != get_rx_buffer(size - 1)))
+		if((low_byte(crc) != modbus_rx_buffer[size - 2]) || (high_byte(crc) != modbus_rx_buffer[size - 1]))
 		{
 			return handle_modbus_error(MB_INVALID_CRC);
 		}
@@ -279,14 +577,22 @@ int8_t modbus_mic(uint8_t id, uint8_t function_code, uint8_t size)
 
 uint8_t response_received()
 {
-	if(response_rx)
+	if(master_port->response_rx)
 	{
-		response_rx = 0;
+		master_port->response_rx = 0;
 		return 1;
 	}
 	return 0;
 }
 
+/*
+ * Returns 1 once the last request has been answered, has failed or has timed out, so the next one can be issued
+ */
+uint8_t modbus_master_idle()
+{
+	return (master_port->expected_rx_len == 0) && master_port->tx_int && !master_port->tx_pending_len;
+}
+
 void set_response_interval(uint32_t delay)
 {
 	response_interval = delay;
@@ -297,465 +603,2386 @@ uint32_t get_response_interval()
 	return response_interval;
 }
 
+/*
+ * Run the master port at baud_rate, USART2 is clocked from PCLK so the generator is searched against that clock
+ */
+int8_t modbus_master_set_baud_rate(uint32_t baud_rate)
+{
+	baud_config_t config;
+	if(modbus_find_baud_config(baud_rate, modbus_kernel_clock(master_port), &config) != MB_SUCCESS)
+	{
+		return handle_modbus_error(RANGE_ERROR);
+	}
+	return modbus_port_set_baud_rate(master_port, baud_rate, &config);
+}
+
 void store_rx_buffer()
 {
-	// Store the messages data in the response_buffer
-	for(uint8_t i = 0; i < get_rx_buffer(2); i++)
+	// Store the messages data in the response_buffer, the byte count covers two bytes per register
+	for(uint8_t i = 0; i < master_port->rx_buffer[2] / 2; i++)
 	{
 		if(i < RX_BUFFER_SIZE)
 		{
-			response_buffer[i] = (get_rx_buffer(2 * i + 3) << 8) | get_rx_buffer(2 * i + 4);
+			response_buffer[i] = (master_port->rx_buffer[2 * i + 3] << 8) | master_port->rx_buffer[2 * i + 4];
 		}
 	}
 }
-#endif // MB_MASTER
-
-// Modbus Slave Functions ---------------------------------------------------------------------
 
-#ifdef MB_SLAVE
-uint8_t modbus_rx()
+/*
+ * Queue a transaction, see modbus.h
+ */
+int8_t modbus_queue(const modbus_transaction_t *transaction)
 {
-	if(uart_rx_int)
+	if(queue_count >= MODBUS_QUEUE_SIZE)
 	{
-		uart_rx_int = 0;
-		return 1;
+		return MB_MEMORY_ERROR;
 	}
-	return 0;
+	if((transaction->function_code != 0x03 && transaction->function_code != 0x04 && transaction->function_code != 0x10) ||
+	   transaction->quantity < 1 || transaction->quantity > RX_BUFFER_SIZE || transaction->data == NULL)
+	{
+		return handle_modbus_error(RANGE_ERROR);
+	}
+	modbus_queued_t *entry = &queue[(queue_head + queue_count) % MODBUS_QUEUE_SIZE];
+	entry->transaction = (*transaction);
+	entry->attempts = 0;
+	entry->schedule_slot = MODBUS_QUEUE_IDLE;
+	queue_count++;
+	return MB_SUCCESS;
 }
 
-int8_t return_holding_registers(uint8_t* tx_len)
+/*
+ * Number of transactions waiting or on the bus
+ */
+uint8_t modbus_queue_count()
 {
-	(*tx_len) = 0;
-	// Handle Error Checking
-	uint16_t first_register_address = (get_rx_buffer(2) << 8) | get_rx_buffer(3);
-
-	// Get the number of registers requested by the master
-	uint16_t num_registers = (get_rx_buffer(4) << 8) | get_rx_buffer(5);
+	return queue_count;
+}
 
-	if(num_registers > RX_BUFFER_SIZE || num_registers < 1) // 125 is the limit according to modbus protocol
+/*
+ * Queue the transaction every interval ms, starting straight away
+ */
+int8_t modbus_schedule(uint8_t slot, const modbus_transaction_t *transaction, uint16_t interval)
+{
+	if(slot >= MODBUS_SCHEDULE_SIZE || interval == 0)
 	{
-		return modbus_exception(MB_ILLEGAL_DATA_VALUE);
+		return handle_modbus_error(RANGE_ERROR);
 	}
+	schedule[slot].transaction = (*transaction);
+	schedule[slot].interval = interval;
+	schedule[slot].due = timer_now();
+	return MB_SUCCESS;
+}
 
-	uint16_t last_register_address = first_register_address + (num_registers - 1);
-
-	if(last_register_address > NUM_HOLDING_REGISTERS)
+/*
+ * Remove a transaction from the schedule table, a copy already queued still completes
+ */
+void modbus_unschedule(uint8_t slot)
+{
+	if(slot < MODBUS_SCHEDULE_SIZE)
 	{
-		return modbus_exception(MB_ILLEGAL_DATA_ADDRESS);
+		schedule[slot].interval = 0;
 	}
+}
 
-	// Return register values
-	modbus_tx_buffer[0] = get_rx_buffer(0); // Append Slave id
-	modbus_tx_buffer[1] = get_rx_buffer(1); // Append Function Code
-	modbus_tx_buffer[2] = num_registers * 2; // Append number of bytes
-	(*tx_len) = 3;
-
-	// Append the Register Values
-	for(uint8_t i = 0; i < num_registers; i++)
+/*
+ * Build a request in the master port's buffer and return its length without the CRC
+ */
+uint8_t modbus_build_request(uint8_t id, uint8_t function_code, uint16_t address, uint16_t quantity, const uint16_t *data)
+{
+	uint8_t *modbus_tx_buffer = master_port->tx_buffer;
+	uint8_t index = 0;
+	modbus_tx_buffer[index++] = id; // Append Modbus ID
+	modbus_tx_buffer[index++] = function_code; // Append Function Code
+	// Append the Address (high byte then low byte)
+	modbus_tx_buffer[index++] = high_byte(address);
+	modbus_tx_buffer[index++] = low_byte(address);
+	// Append the quantity of registers (high byte then low byte)
+	modbus_tx_buffer[index++] = high_byte(quantity);
+	modbus_tx_buffer[index++] = low_byte(quantity);
+
+	if(function_code == 0x10)
 	{
-		modbus_tx_buffer[(*tx_len)++] = high_byte(holding_register_database[first_register_address + i]);
-		modbus_tx_buffer[(*tx_len)++] = low_byte(holding_register_database[first_register_address + i]);
+		// Append the number of bytes, then the values (high byte then low byte)
+		modbus_tx_buffer[index++] = quantity * 2;
+		for(uint8_t i = 0; i < quantity; i++)
+		{
+			modbus_tx_buffer[index++] = high_byte(data[i]);
+			modbus_tx_buffer[index++] = low_byte(data[i]);
+		}
 	}
-
-	return modbus_send((*tx_len));
+	return index;
 }
 
-int8_t edit_multiple_registers(uint8_t *tx_len)
+/*
+ * Send the request in the master port's buffer and setup the master to expect a response
+ * The request is held back until the inter-frame gap since the last frame on the bus has passed
+ */
+int8_t modbus_master_transmit(uint8_t size, uint8_t id, uint8_t function_code, uint16_t expected_rx_len, uint32_t timeout)
 {
-	(*tx_len) = 0;
-
-	// Handle Error Checking
-	uint16_t first_register_address = (get_rx_buffer(2) << 8) | get_rx_buffer(3);
-
-	uint16_t num_registers = (get_rx_buffer(4) << 8) | get_rx_buffer(5);
-
-	if(num_registers > 125 || num_registers < 1) // 125 is the limit according to modbus protocol
+	if(master_port->role != MODBUS_ROLE_MASTER)
 	{
-		return modbus_exception(MB_ILLEGAL_DATA_VALUE);
+		return HAL_ERROR;
 	}
-
-	uint16_t last_register_address = first_register_address + (num_registers - 1);
-
-	if(last_register_address > NUM_HOLDING_REGISTERS)
+	if(!modbus_master_idle())
 	{
-		return modbus_exception(MB_ILLEGAL_DATA_ADDRESS);
+		return HAL_BUSY;
 	}
 
-	// Protect Read only values
-	if(((first_register_address >= GPIO_READ) && (first_register_address <= GPIO_READ)) ||
-		 ((last_register_address >= GPIO_READ) && (last_register_address <= GPIO_READ)) ||
-		 ((first_register_address < GPIO_READ  && last_register_address > GPIO_READ)))
+	// The clock may have dropped while the port was idle, raising it under the request would reset the port
+	clock_wake();
+	if(master_port->clock_stale && modbus_port_reclock(master_port) != MB_SUCCESS)
 	{
-		// Ensure that sensor values are restricted to read-only
-		return modbus_exception(MB_ILLEGAL_FUNCTION);
+		return MB_FATAL_ERROR;
 	}
 
-	// Edit holding registers
-	modbus_tx_buffer[0] = get_rx_buffer(0); // Append Slave id
-	modbus_tx_buffer[1] = get_rx_buffer(1); // Append Function Code
-	// Append the Write Address (high byte then low byte)
-	modbus_tx_buffer[2] = get_rx_buffer(2);
-	modbus_tx_buffer[3] = get_rx_buffer(3);
-	// Append the quantity of registers to be written (high byte then low byte)
-	modbus_tx_buffer[4] = get_rx_buffer(4);
-	modbus_tx_buffer[5] = get_rx_buffer(5);
-	(*tx_len) = 6;
+	// A late response to an earlier request must not be taken for the answer to this one
+	HAL_UART_AbortReceive(master_port->huart);
+	timer_stop(master_port->chunk_timer);
+	master_port->header = 1;
+	master_port->rx_int = 0;
+	master_port->response_rx = 0;
 
-	for(uint8_t i = 0; i < num_registers; i++)
-	{
-		holding_register_database[first_register_address + i] = (get_rx_buffer(2 * i + 7) << 8) | get_rx_buffer(2 * i + 8);
+	uint32_t gap = modbus_frame_gap(master_port);
+	int32_t elapsed = (int32_t)(timer_now() - master_port->idle_since);
+	uint32_t delay = (elapsed >= 0 && (uint32_t)elapsed < gap) ? gap - elapsed : 0;
 
-		// Handle the range boundaries of each writable register
-		handle_range(first_register_address + i);
+	int8_t status = (delay > 0) ? modbus_port_send_delayed(master_port, size, delay) : modbus_port_send(master_port, size);
+	if(status != HAL_OK)
+	{
+		return status;
 	}
 
-	// TIMING WORKAROUND START
-	HAL_Delay(1);
-	// TIMING WORKAROUND END
-
-	int8_t status = modbus_send((*tx_len));
-
-	if(status == MB_SUCCESS)
+	// Nothing answers a broadcast
+	if(id == MB_BROADCAST_ADDRESS)
 	{
-		// Special Case Modbus Baud Rate Modification
-		if((first_register_address <= 1) && last_register_address >= 1)
-		{
-			return modbus_change_baud_rate();
-		}
+		master_port->result = MB_SUCCESS;
+		return MB_SUCCESS;
 	}
-	return status;
+	master_port->target_id = id;
+	master_port->target_function_code = function_code;
+	master_port->expected_rx_len = expected_rx_len; // This will enable rx timeout monitoring
+	master_port->result = MB_RX_TIMEOUT;
+	timer_start_us(master_port->rx_timer, timeout * TIMER_TICKS_PER_MS + delay, NULL);
+	return modbus_port_set_rx(master_port);
 }
 
-int8_t modbus_exception(int8_t exception_code)
+/*
+ * 3.5 character times of silence separate two frames, fixed at 1750us above 19200 baud
+ */
+uint32_t modbus_frame_gap(modbus_port_t *port)
 {
-	modbus_tx_buffer[0] = get_rx_buffer(0);
-	modbus_tx_buffer[1] = get_rx_buffer(1) | 0x80;
-	modbus_tx_buffer[2] = exception_code - 3; // Subtract 3 to match the modbus defined error code value
-
-	return modbus_send(3);
+	uint32_t gap = (35U * 11U * 100000U) / port->huart->Init.BaudRate; // 11 bits a character covers any parity setting
+	return (gap > MODBUS_FRAME_GAP_MIN) ? gap : MODBUS_FRAME_GAP_MIN;
 }
 
-void handle_range(uint16_t holding_register)
+/*
+ * Move due schedule entries into the queue, collect the result of the transaction on the bus and issue the next one
+ */
+void modbus_queue_service()
 {
-	switch(holding_register)
+	// The timer only exists to wake the super-loop, consume its event
+	timer_expired(TIMER_MB_SCHEDULE);
+
+	// The schedule is held while the port is given another role through MB2_ROLE
+	if(master_port->role != MODBUS_ROLE_MASTER)
 	{
-		case MODBUS_ID:
+		timer_stop(TIMER_MB_SCHEDULE);
+		return;
+	}
+
+	if(queue_active && modbus_master_idle())
+	{
+		modbus_queue_complete();
+	}
+
+	uint32_t now = timer_now();
+	uint32_t wait = 0xFFFFFFFF;
+	for(uint8_t i = 0; i < MODBUS_SCHEDULE_SIZE; i++)
+	{
+		modbus_scheduled_t *entry = &schedule[i];
+		if(entry->interval == 0 || entry->queued)
 		{
-			if(holding_register_database[holding_register] > 0xFF)
-			{
-				holding_register_database[holding_register] = 0xFF;
-			}
-			break;
+			continue;
 		}
-		case MB_BAUD_RATE:
+		int32_t remaining = (int32_t)(entry->due - now);
+		if(remaining > 0)
 		{
-			if(holding_register_database[holding_register] < BAUD_RATE_4800)
-			{
-				holding_register_database[holding_register] = BAUD_RATE_4800;
-			}
-			else if(holding_register_database[holding_register] > BAUD_RATE_256000)
+			if((uint32_t)remaining < wait)
 			{
-				holding_register_database[holding_register] = BAUD_RATE_256000;
+				wait = remaining;
 			}
-			break;
+			continue;
 		}
-		case MB_TRANSMIT_TIMEOUT:
+		if(modbus_queue(&entry->transaction) != MB_SUCCESS)
 		{
-			if(holding_register_database[holding_register] < 5)
-			{
-				holding_register_database[holding_register] = 5;
+			// Try again on the next pass once the queue has drained
+			continue;
+		}
+		queue[(queue_head + queue_count - 1) % MODBUS_QUEUE_SIZE].schedule_slot = i;
+		entry->queued = 1;
+
+		// Keep to the period, unless the bus has fallen so far behind that whole periods were missed
+		entry->due += entry->interval * TIMER_TICKS_PER_MS;
+		if((int32_t)(entry->due - now) <= 0)
+		{
+			entry->due = now + entry->interval * TIMER_TICKS_PER_MS;
+		}
+	}
+	if(wait != 0xFFFFFFFF)
+	{
+		timer_start_us(TIMER_MB_SCHEDULE, wait, NULL);
+	}
+	else
+	{
+		timer_stop(TIMER_MB_SCHEDULE);
+	}
+
+	if(queue_count > 0 && !queue_active && modbus_master_idle())
+	{
+		modbus_queue_issue();
+	}
+}
+
+int8_t modbus_queue_issue()
+{
+	modbus_transaction_t *transaction = &queue[queue_head].transaction;
+	uint16_t expected_rx_len = (transaction->function_code == 0x10) ? 8 : 3 + transaction->quantity * 2 + 2;
+	uint8_t size = modbus_build_request(transaction->id, transaction->function_code, transaction->address,
+										transaction->quantity, transaction->data);
+
+	int8_t status = modbus_master_transmit(size, transaction->id, transaction->function_code, expected_rx_len, transaction->timeout);
+	if(status != MB_SUCCESS)
+	{
+		// Counts as a failed attempt
+		master_port->result = status;
+		modbus_queue_complete();
+		return status;
+	}
+	queue_active = 1;
+	return MB_SUCCESS;
+}
+
+/*
+ * Retry the transaction at the head of the queue or hand its result to the callback and remove it
+ */
+void modbus_queue_complete()
+{
+	modbus_queued_t *entry = &queue[queue_head];
+	modbus_transaction_t *transaction = &entry->transaction;
+	int8_t status = master_port->result;
+	queue_active = 0;
+
+	// An exception is the slave's answer, asking again will not change it
+	uint8_t exception = (status >= MB_ILLEGAL_FUNCTION && status <= MB_GATEWAY_RX_ERROR);
+	if(status != MB_SUCCESS && !exception && entry->attempts < transaction->retries)
+	{
+		entry->attempts++;
+		return;
+	}
+
+	if(status == MB_SUCCESS && transaction->function_code != 0x10 && transaction->id != MB_BROADCAST_ADDRESS)
+	{
+		for(uint8_t i = 0; i < transaction->quantity && i < master_port->rx_buffer[2] / 2; i++)
+		{
+			transaction->data[i] = (master_port->rx_buffer[2 * i + 3] << 8) | master_port->rx_buffer[2 * i + 4];
+		}
+	}
+	if(entry->schedule_slot != MODBUS_QUEUE_IDLE)
+	{
+		schedule[entry->schedule_slot].queued = 0;
+	}
+
+	queue_head = (queue_head + 1) % MODBUS_QUEUE_SIZE;
+	queue_count--;
+	if(transaction->callback != NULL)
+	{
+		transaction->callback(transaction->tag, status);
+	}
+}
+
+/*
+ * Drop every queued transaction without calling back, used when the port stops being the master
+ */
+void modbus_queue_flush()
+{
+	queue_head = 0;
+	queue_count = 0;
+	queue_active = 0;
+	for(uint8_t i = 0; i < MODBUS_SCHEDULE_SIZE; i++)
+	{
+		schedule[i].queued = 0;
+	}
+}
+#endif // MB_MASTER
+
+// Modbus Slave Functions ---------------------------------------------------------------------
+
+#ifdef MB_SLAVE
+uint8_t modbus_rx()
+{
+	for(uint8_t i = 0; i < NUM_MODBUS_PORTS; i++)
+	{
+		modbus_port_t *port = &modbus_ports[i];
+		if(port->role != MODBUS_ROLE_SLAVE || !port->rx_int)
+		{
+			continue;
+		}
+		port->rx_int = 0;
+		active_port = port;
+		if(port->response_due)
+		{
+			port->response_due = 0;
+			port->counter[MB_COUNT_NO_RESPONSE]++;
+		}
+		if(port->trace_pending)
+		{
+			modbus_trace_commit(port, 0xFFFF);
+		}
+
+		// The frame times are copied before the next frame can overwrite them, the response is timed in modbus_send()
+		port->latency_state = LATENCY_STATE_IDLE;
+		port->latency_function_code = port->rx_buffer[1];
+		port->latency_time[LATENCY_FIRST_BYTE] = port->rx_start_time;
+		port->latency_time[LATENCY_FRAME_END] = port->rx_frame_time;
+		port->latency_time[LATENCY_MAIN] = timer_now();
+		if(!modbus_crc_valid())
+		{
+			port->counter[MB_COUNT_BUS_ERROR]++;
+			modbus_trace_start(port, TRACE_CRC_ERROR);
+			modbus_trace_commit(port, 0xFFFF);
+			handle_modbus_error(MB_INVALID_CRC);
+			if(port == primary_port)
+			{
+				modbus_rx_error();
 			}
-			else if(holding_register_database[holding_register] > 1000)
+			return 0;
+		}
+		// Port 2 only lets frames for this board through, port 1 lets everything through while detecting the rate
+		if(port != primary_port || modbus_address_match(port->rx_buffer[0]))
+		{
+			port->counter[MB_COUNT_SLAVE_MESSAGE]++;
+			port->response_due = 1;
+			modbus_trace_start(port, TRACE_NO_RESPONSE);
+		}
+		if(port != primary_port)
+		{
+			return 1;
+		}
+		consecutive_rx_errors = 0;
+		if(baud_switch_state == BAUD_SWITCH_PROBATION)
+		{
+			modbus_baud_switch_commit();
+		}
+		if(auto_baud_active)
+		{
+			if(modbus_auto_baud_lock() != MB_SUCCESS)
 			{
-				holding_register_database[holding_register] = 1000;
+				return 0;
+			}
+		}
+		return 1;
+	}
+	return 0;
+}
+
+int8_t return_holding_registers(uint8_t* tx_len)
+{
+	return return_registers(holding_register_database, NUM_HOLDING_REGISTERS, tx_len);
+}
+
+int8_t return_input_registers(uint8_t* tx_len)
+{
+	return return_registers(input_register_database, NUM_INPUT_REGISTERS, tx_len);
+}
+
+int8_t edit_multiple_registers(uint8_t *tx_len)
+{
+	uint8_t *modbus_tx_buffer = active_port->tx_buffer;
+	(*tx_len) = 0;
+
+	// Checked before the write, which may change this board's group membership
+	uint8_t broadcast = modbus_broadcast_match(get_rx_buffer(0));
+
+	// Handle Error Checking
+	uint16_t first_register_address = (get_rx_buffer(2) << 8) | get_rx_buffer(3);
+
+	uint16_t num_registers = (get_rx_buffer(4) << 8) | get_rx_buffer(5);
+
+	if(num_registers > 125 || num_registers < 1) // 125 is the limit according to modbus protocol
+	{
+		return modbus_exception(MB_ILLEGAL_DATA_VALUE);
+	}
+
+	uint16_t last_register_address = first_register_address + (num_registers - 1);
+
+	if(last_register_address >= NUM_HOLDING_REGISTERS)
+	{
+		return modbus_exception(MB_ILLEGAL_DATA_ADDRESS);
+	}
+
+	// An activation time means nothing without an epoch, either held from an earlier frame or written alongside it
+	uint8_t epoch_written = (first_register_address <= SYNC_EPOCH_LOW) && (last_register_address >= SYNC_EPOCH_LOW);
+	uint8_t schedule_written = (first_register_address <= SCHEDULE_TIME_LOW) && (last_register_address >= SCHEDULE_TIME_LOW);
+	if(schedule_written && !epoch_written && sync_get_state() == SYNC_STATE_FREE)
+	{
+		return modbus_exception(MB_ILLEGAL_DATA_VALUE);
+	}
+
+	// Protect Read only values
+	if(((first_register_address >= GPIO_READ) && (first_register_address <= GPIO_READ)) ||
+		 ((last_register_address >= GPIO_READ) && (last_register_address <= GPIO_READ)) ||
+		 ((first_register_address < GPIO_READ  && last_register_address > GPIO_READ)))
+	{
+		// Ensure that sensor values are restricted to read-only
+		return modbus_exception(MB_ILLEGAL_FUNCTION);
+	}
+
+	// Edit holding registers
+	modbus_tx_buffer[0] = get_rx_buffer(0); // Append Slave id
+	modbus_tx_buffer[1] = get_rx_buffer(1); // Append Function Code
+	// Append the Write Address (high byte then low byte)
+	modbus_tx_buffer[2] = get_rx_buffer(2);
+	modbus_tx_buffer[3] = get_rx_buffer(3);
+	// Append the quantity of registers to be written (high byte then low byte)
+	modbus_tx_buffer[4] = get_rx_buffer(4);
+	modbus_tx_buffer[5] = get_rx_buffer(5);
+	(*tx_len) = 6;
+
+	for(uint8_t i = 0; i < num_registers; i++)
+	{
+		holding_register_database[first_register_address + i] = (get_rx_buffer(2 * i + 7) << 8) | get_rx_buffer(2 * i + 8);
+
+		// Handle the range boundaries of each writable register
+		handle_range(first_register_address + i);
+	}
+
+	// Special Case Modbus Baud Rate Modification
+	uint8_t baud_rate_written = ((first_register_address <= MB_BAUD_RATE) && (last_register_address >= MB_BAUD_RATE)) ||
+								((first_register_address <= MB_BAUD_LOW) && (last_register_address >= MB_BAUD_HIGH));
+	if(baud_rate_written)
+	{
+		previous_baud_rate = huart1.Init.BaudRate;
+		handle_baud_rate_range(first_register_address, last_register_address);
+	}
+
+	// Special Case Time Synchronisation, the epoch is the bus time when this frame completed
+	if(epoch_written)
+	{
+		sync_set_epoch(((uint32_t)holding_register_database[SYNC_EPOCH_HIGH] << 16) | holding_register_database[SYNC_EPOCH_LOW], active_port->rx_frame_time);
+	}
+	if(schedule_written)
+	{
+		sync_schedule(((uint32_t)holding_register_database[SCHEDULE_TIME_HIGH] << 16) | holding_register_database[SCHEDULE_TIME_LOW],
+					  holding_register_database[SCHEDULE_GPIO]);
+	}
+
+	int8_t ee_status = MB_SUCCESS;
+	if(((first_register_address <= MODBUS_ID) && (last_register_address >= MODBUS_ID)) ||
+	   ((first_register_address <= MB_GROUP_4) && (last_register_address >= MB_GROUP_1)))
+	{
+		ee_status = modbus_store_address();
+	}
+	if((first_register_address <= MB2_ID) && (last_register_address >= MB2_BAUD_RATE))
+	{
+		// Applied to USART2 by monitor_modbus() once its response has left
+		int8_t port_status = modbus_store_port_config();
+		ee_status = (ee_status != MB_SUCCESS) ? ee_status : port_status;
+	}
+
+	int8_t status = MB_SUCCESS;
+	if(broadcast)
+	{
+		// Broadcast and group writes are never acknowledged, go straight back to listening
+		status = modbus_set_rx();
+	}
+	else
+	{
+		// Give the master time to turn the bus around before the response goes out
+		status = modbus_send_delayed((*tx_len), MODBUS_TURNAROUND_DELAY);
+	}
+
+	if(status == MB_SUCCESS && baud_rate_written)
+	{
+		// Applied by monitor_modbus() once the response has left at the old baud rate
+		baud_switch_state = BAUD_SWITCH_PENDING;
+	}
+	if(status == MB_SUCCESS && holding_register_database[MB_AUTO_BAUD] == AUTO_BAUD_DETECT &&
+	  (first_register_address <= MB_AUTO_BAUD) && (last_register_address >= MB_AUTO_BAUD))
+	{
+		auto_baud_pending = 1;
+	}
+	return (status != MB_SUCCESS) ? status : ee_status;
+}
+
+int8_t modbus_exception(int8_t exception_code)
+{
+	uint8_t *modbus_tx_buffer = active_port->tx_buffer;
+
+	// Nobody listens for a response to a broadcast or group command
+	if(modbus_broadcast_match(get_rx_buffer(0)))
+	{
+		return modbus_set_rx();
+	}
+
+	modbus_tx_buffer[0] = get_rx_buffer(0);
+	modbus_tx_buffer[1] = get_rx_buffer(1) | 0x80;
+	modbus_tx_buffer[2] = exception_code - 3; // Subtract 3 to match the modbus defined error code value
+	active_port->counter[MB_COUNT_EXCEPTION]++;
+	active_port->trace.result = modbus_tx_buffer[2];
+
+	return modbus_send(3);
+}
+
+/*
+ * UID enumeration, see modbus.h for the frame layout
+ */
+int8_t modbus_enumerate(uint8_t *tx_len)
+{
+	uint8_t *modbus_tx_buffer = active_port->tx_buffer;
+	(*tx_len) = 0;
+	const uint8_t *uid = (const uint8_t *)UID_BASE;
+	uint8_t sub_function = get_rx_buffer(2);
+	uint8_t parameter = get_rx_buffer(3);
+
+	if(sub_function == ENUMERATE_RESET)
+	{
+		enumerated = 0;
+		return modbus_set_rx();
+	}
+
+	// Search and assign carry a full UID
+	if(active_port->rx_frame_len < 6 + MB_UID_SIZE + 2 || ((get_rx_buffer(4) << 8) | get_rx_buffer(5)) != MB_UID_SIZE / 2)
+	{
+		return modbus_set_rx();
+	}
+
+	if(sub_function == ENUMERATE_SEARCH)
+	{
+		if(enumerated || parameter > MB_UID_SIZE * 8)
+		{
+			return modbus_set_rx();
+		}
+		for(uint8_t bit = 0; bit < parameter; bit++)
+		{
+			if(modbus_uid_bit(uid, bit) != modbus_uid_bit(&active_port->rx_buffer[6], bit))
+			{
+				return modbus_set_rx();
+			}
+		}
+
+		modbus_tx_buffer[0] = MB_DISCOVERY_ADDRESS;
+		modbus_tx_buffer[1] = MB_ENUMERATE;
+		modbus_tx_buffer[2] = ENUMERATE_SEARCH;
+		modbus_tx_buffer[3] = holding_register_database[MODBUS_ID];
+		modbus_tx_buffer[4] = 0x00;
+		modbus_tx_buffer[5] = MB_UID_SIZE / 2;
+		(*tx_len) = 6;
+		for(uint8_t i = 0; i < MB_UID_SIZE; i++)
+		{
+			modbus_tx_buffer[(*tx_len)++] = uid[i];
+		}
+
+		// Boards on either side of the next UID bit answer in separate slots
+		uint8_t slot = (parameter < MB_UID_SIZE * 8) ? modbus_uid_bit(uid, parameter) : 0;
+		return modbus_send_delayed((*tx_len), MODBUS_TURNAROUND_DELAY + slot * modbus_enumerate_slot());
+	}
+	else if(sub_function == ENUMERATE_ASSIGN)
+	{
+		for(uint8_t i = 0; i < MB_UID_SIZE; i++)
+		{
+			if(get_rx_buffer(6 + i) != uid[i])
+			{
+				return modbus_set_rx();
+			}
+		}
+		if(parameter < 1 || parameter > MB_MAX_SLAVE_ID)
+		{
+			return modbus_exception(MB_ILLEGAL_DATA_VALUE);
+		}
+
+		holding_register_database[MODBUS_ID] = parameter;
+		enumerated = 1;
+		int8_t ee_status = modbus_store_address();
+
+		// Echo the request
+		for(uint8_t i = 0; i < 6 + MB_UID_SIZE; i++)
+		{
+			modbus_tx_buffer[i] = get_rx_buffer(i);
+		}
+		(*tx_len) = 6 + MB_UID_SIZE;
+		int8_t status = modbus_send_delayed((*tx_len), MODBUS_TURNAROUND_DELAY);
+		return (status != MB_SUCCESS) ? status : ee_status;
+	}
+	return modbus_exception(MB_ILLEGAL_FUNCTION);
+}
+
+/*
+ * Diagnostics (function code 0x08), see modbus.h for the sub-functions
+ */
+int8_t modbus_diagnostics(uint8_t *tx_len)
+{
+	uint8_t *modbus_tx_buffer = active_port->tx_buffer;
+	uint16_t rx_frame_len = active_port->rx_frame_len;
+	(*tx_len) = 0;
+	uint16_t sub_function = (get_rx_buffer(2) << 8) | get_rx_buffer(3);
+	uint16_t data = (get_rx_buffer(4) << 8) | get_rx_buffer(5);
+
+	if(rx_frame_len < 8)
+	{
+		return modbus_exception(MB_ILLEGAL_DATA_VALUE);
+	}
+
+	// Every response starts by echoing the request
+	for(uint8_t i = 0; i < 6; i++)
+	{
+		modbus_tx_buffer[i] = get_rx_buffer(i);
+	}
+	(*tx_len) = 6;
+
+	if(sub_function == DIAGNOSTIC_RETURN_QUERY_DATA)
+	{
+		while((*tx_len) < rx_frame_len - 2)
+		{
+			modbus_tx_buffer[(*tx_len)] = get_rx_buffer((*tx_len));
+			(*tx_len)++;
+		}
+		return modbus_send((*tx_len));
+	}
+	if(rx_frame_len != 8)
+	{
+		return modbus_exception(MB_ILLEGAL_DATA_VALUE);
+	}
+
+	switch(sub_function)
+	{
+		case DIAGNOSTIC_RESTART_COMMS:
+		{
+			if(data != 0x0000 && data != 0xFF00)
+			{
+				return modbus_exception(MB_ILLEGAL_DATA_VALUE);
 			}
+			modbus_clear_counters(active_port);
 			break;
 		}
-		case MB_TRANSMIT_RETRIES:
+		case DIAGNOSTIC_CLEAR_COUNTERS:
 		{
-			if(holding_register_database[holding_register] > 5)
+			if(data != 0x0000)
 			{
-				holding_register_database[holding_register] = 5;
+				return modbus_exception(MB_ILLEGAL_DATA_VALUE);
 			}
+			modbus_clear_counters(active_port);
 			break;
 		}
-		case MB_ERRORS:
+		case DIAGNOSTIC_CLEAR_OVERRUN:
+		{
+			if(data != 0x0000)
+			{
+				return modbus_exception(MB_ILLEGAL_DATA_VALUE);
+			}
+			active_port->counter[MB_COUNT_OVERRUN] = 0;
+			break;
+		}
+		default:
 		{
-			if(holding_register_database[holding_register] > 0x3FF)
+			if(sub_function < DIAGNOSTIC_BUS_MESSAGE_COUNT || sub_function > DIAGNOSTIC_BUS_OVERRUN_COUNT)
 			{
-				holding_register_database[holding_register] = 0x3FF;
+				return modbus_exception(MB_ILLEGAL_FUNCTION);
 			}
+			if(data != 0x0000)
+			{
+				return modbus_exception(MB_ILLEGAL_DATA_VALUE);
+			}
+			uint16_t count = active_port->counter[sub_function - DIAGNOSTIC_BUS_MESSAGE_COUNT];
+			modbus_tx_buffer[4] = high_byte(count);
+			modbus_tx_buffer[5] = low_byte(count);
 			break;
 		}
 	}
+	return modbus_send((*tx_len));
+}
+
+/*
+ * Read file record (function code 0x14), see modbus.h
+ */
+int8_t modbus_read_file_record(uint8_t *tx_len)
+{
+	uint8_t *modbus_tx_buffer = active_port->tx_buffer;
+	(*tx_len) = 0;
+	uint8_t byte_count = get_rx_buffer(2);
+
+	if(byte_count < 7 || byte_count % 7 != 0 || active_port->rx_frame_len != 3 + byte_count + 2)
+	{
+		return modbus_exception(MB_ILLEGAL_DATA_VALUE);
+	}
+
+	modbus_tx_buffer[0] = get_rx_buffer(0); // Append Slave id
+	modbus_tx_buffer[1] = get_rx_buffer(1); // Append Function Code
+	(*tx_len) = 3; // The response length is filled in once every sub-request has been read
+
+	for(uint8_t i = 3; i < 3 + byte_count; i += 7)
+	{
+		uint16_t file = (get_rx_buffer(i + 1) << 8) | get_rx_buffer(i + 2);
+		uint16_t record = (get_rx_buffer(i + 3) << 8) | get_rx_buffer(i + 4);
+		uint16_t length = (get_rx_buffer(i + 5) << 8) | get_rx_buffer(i + 6);
+
+		if(get_rx_buffer(i) != MB_FILE_REFERENCE_TYPE || length < 1 ||
+		   ((*tx_len) - 3) + 2 + length * 2 > MB_FILE_RESPONSE_MAX)
+		{
+			return modbus_exception(MB_ILLEGAL_DATA_VALUE);
+		}
+
+		int8_t status = MB_ILLEGAL_DATA_ADDRESS;
+		switch(file)
+		{
+			case MB_FILE_TRACE:
+			{
+				status = trace_read(record, length, &modbus_tx_buffer[(*tx_len) + 2]);
+				break;
+			}
+			case MB_FILE_JOURNAL:
+			{
+				status = journal_read(record, length, &modbus_tx_buffer[(*tx_len) + 2]);
+				break;
+			}
+			case MB_FILE_PROFILE:
+			{
+				status = profile_read(record, length, &modbus_tx_buffer[(*tx_len) + 2]);
+				break;
+			}
+		}
+		if(status != MB_SUCCESS)
+		{
+			return modbus_exception(status);
+		}
+		modbus_tx_buffer[(*tx_len)] = 1 + length * 2; // Sub-response length, including the reference type
+		modbus_tx_buffer[(*tx_len) + 1] = MB_FILE_REFERENCE_TYPE;
+		(*tx_len) += 2 + length * 2;
+	}
+	modbus_tx_buffer[2] = (*tx_len) - 3;
+
+	return modbus_send((*tx_len));
+}
+
+void handle_range(uint16_t holding_register)
+{
+	switch(holding_register)
+	{
+		case MODBUS_ID:
+		{
+			if(holding_register_database[holding_register] > 0xFF)
+			{
+				holding_register_database[holding_register] = 0xFF;
+			}
+			break;
+		}
+		case MB_BAUD_RATE:
+		{
+			if(holding_register_database[holding_register] < BAUD_RATE_4800)
+			{
+				holding_register_database[holding_register] = BAUD_RATE_4800;
+			}
+			else if(holding_register_database[holding_register] > BAUD_RATE_3000000)
+			{
+				holding_register_database[holding_register] = BAUD_RATE_3000000;
+			}
+			break;
+		}
+		case MB_TRANSMIT_TIMEOUT:
+		{
+			if(holding_register_database[holding_register] < 5)
+			{
+				holding_register_database[holding_register] = 5;
+			}
+			else if(holding_register_database[holding_register] > 1000)
+			{
+				holding_register_database[holding_register] = 1000;
+			}
+			break;
+		}
+		case MB_TRANSMIT_RETRIES:
+		{
+			if(holding_register_database[holding_register] > 5)
+			{
+				holding_register_database[holding_register] = 5;
+			}
+			break;
+		}
+		case MB_ERRORS:
+		{
+			// Only the flags listed in error_codes.h exist, the host writes back the ones it wants to keep
+			holding_register_database[holding_register] &= MB_ERRORS_MASK;
+			break;
+		}
+		case IDLE_MODE:
+		{
+			if(holding_register_database[holding_register] >= NUM_IDLE_MODES)
+			{
+				holding_register_database[holding_register] = IDLE_MODE_STOP;
+			}
+			break;
+		}
+		case CLOCK_PROFILE:
+		{
+			if(holding_register_database[holding_register] >= NUM_CLOCK_PROFILES)
+			{
+				holding_register_database[holding_register] = CLOCK_PROFILE_HSE_8MHZ;
+			}
+			break;
+		}
+		case CLOCK_SCALING:
+		{
+			if(holding_register_database[holding_register] > 1)
+			{
+				holding_register_database[holding_register] = 1;
+			}
+			break;
+		}
+		case MB_BAUD_PROBATION:
+		{
+			if(holding_register_database[holding_register] < 100)
+			{
+				holding_register_database[holding_register] = 100;
+			}
+			else if(holding_register_database[holding_register] > 60000)
+			{
+				holding_register_database[holding_register] = 60000;
+			}
+			break;
+		}
+		case MB_GROUP_1:
+		case MB_GROUP_2:
+		case MB_GROUP_3:
+		case MB_GROUP_4:
+		{
+			// 0 leaves the slot unused, the discovery address can never be a group
+			if(holding_register_database[holding_register] >= 0xFF)
+			{
+				holding_register_database[holding_register] = 0;
+			}
+			break;
+		}
+		case RELAY_STAGGER_MODE:
+		{
+			if(holding_register_database[holding_register] >= NUM_STAGGER_MODES)
+			{
+				holding_register_database[holding_register] = STAGGER_DISABLED;
+			}
+			break;
+		}
+		case RELAY_STAGGER_SLOT:
+		{
+			if(holding_register_database[holding_register] > 0xFF)
+			{
+				holding_register_database[holding_register] = 0xFF;
+			}
+			break;
+		}
+		case RELAY_STAGGER_SLOTS:
+		{
+			if(holding_register_database[holding_register] < 1)
+			{
+				holding_register_database[holding_register] = 1;
+			}
+			else if(holding_register_database[holding_register] > 0xFF)
+			{
+				holding_register_database[holding_register] = 0xFF;
+			}
+			break;
+		}
+		case RELAY_STAGGER_STEP:
+		{
+			if(holding_register_database[holding_register] > 10000)
+			{
+				holding_register_database[holding_register] = 10000;
+			}
+			break;
+		}
+		case SCHEDULE_GPIO:
+		{
+			holding_register_database[holding_register] &= (RELAY_120_MASK | RELAY_480_MASK);
+			break;
+		}
+		case MB_AUTO_BAUD:
+		{
+			if(holding_register_database[holding_register] > AUTO_BAUD_DETECT)
+			{
+				holding_register_database[holding_register] = AUTO_BAUD_ENABLED;
+			}
+			break;
+		}
+		case MB2_BAUD_RATE:
+		{
+			if(holding_register_database[holding_register] < BAUD_RATE_4800)
+			{
+				holding_register_database[holding_register] = BAUD_RATE_4800;
+			}
+			else if(holding_register_database[holding_register] > BAUD_RATE_3000000)
+			{
+				holding_register_database[holding_register] = BAUD_RATE_3000000;
+			}
+			break;
+		}
+		case MB2_ROLE:
+		{
+			if(!modbus_port_2_role_valid(holding_register_database[holding_register]))
+			{
+				holding_register_database[holding_register] = MODBUS_ROLE_DISABLED;
+			}
+			break;
+		}
+		case MB2_ID:
+		{
+			if(holding_register_database[holding_register] < 1 || holding_register_database[holding_register] > MB_MAX_SLAVE_ID)
+			{
+				holding_register_database[holding_register] = 1;
+			}
+			break;
+		}
+		case WDG_PORTS:
+		{
+			holding_register_database[holding_register] &= (1U << NUM_MODBUS_PORTS) - 1;
+			break;
+		}
+		case GATEWAY_TIMEOUT:
+		{
+			if(holding_register_database[holding_register] < 10)
+			{
+				holding_register_database[holding_register] = 10;
+			}
+			else if(holding_register_database[holding_register] > 1000)
+			{
+				holding_register_database[holding_register] = 1000;
+			}
+			break;
+		}
+		case GATEWAY_1_ID:
+		case GATEWAY_2_ID:
+		case GATEWAY_3_ID:
+		case GATEWAY_4_ID:
+		{
+			// 0 leaves the entry unused
+			if(holding_register_database[holding_register] > MB_MAX_SLAVE_ID)
+			{
+				holding_register_database[holding_register] = 0;
+			}
+			break;
+		}
+		case GATEWAY_1_FUNCTION:
+		case GATEWAY_2_FUNCTION:
+		case GATEWAY_3_FUNCTION:
+		case GATEWAY_4_FUNCTION:
+		{
+			if(holding_register_database[holding_register] != 0x03 && holding_register_database[holding_register] != 0x04)
+			{
+				holding_register_database[holding_register] = 0x03;
+			}
+			break;
+		}
+		case GATEWAY_1_COUNT:
+		case GATEWAY_2_COUNT:
+		case GATEWAY_3_COUNT:
+		case GATEWAY_4_COUNT:
+		{
+			if(holding_register_database[holding_register] < 1)
+			{
+				holding_register_database[holding_register] = 1;
+			}
+			else if(holding_register_database[holding_register] > GATEWAY_MIRROR_SIZE)
+			{
+				holding_register_database[holding_register] = GATEWAY_MIRROR_SIZE;
+			}
+			break;
+		}
+		case GATEWAY_1_INTERVAL:
+		case GATEWAY_2_INTERVAL:
+		case GATEWAY_3_INTERVAL:
+		case GATEWAY_4_INTERVAL:
+		{
+			if(holding_register_database[holding_register] < 10)
+			{
+				holding_register_database[holding_register] = 10;
+			}
+			break;
+		}
+		case ERROR_SNAPSHOT:
+		{
+			// A command, any write moves the error counters into the ERROR_COUNT registers and it reads back as 0
+			diag_snapshot();
+			holding_register_database[holding_register] = 0;
+			break;
+		}
+		case PROFILE_CONTROL:
+		{
+			// Any value other than PROFILE_STOP clears the samples and starts a new profile
+			if(holding_register_database[holding_register] == PROFILE_STOP)
+			{
+				profile_stop();
+			}
+			else
+			{
+				holding_register_database[holding_register] = PROFILE_RUN;
+				profile_start();
+			}
+			break;
+		}
+		case LOAD_RESET:
+		{
+			// A command, any write clears the super-loop statistics and it reads back as 0
+			load_reset();
+			holding_register_database[holding_register] = 0;
+			break;
+		}
+		case LATENCY_RESET:
+		{
+			// A command rather than a setting, any write clears the statistics and it reads back as 0
+			latency_reset();
+			holding_register_database[holding_register] = 0;
+			break;
+		}
+		case TELEMETRY_MODE:
+		{
+			holding_register_database[holding_register] &= TELEMETRY_MODE_MASK;
+			break;
+		}
+		case TELEMETRY_INTERVAL:
+		{
+			if(holding_register_database[holding_register] < 1)
+			{
+				holding_register_database[holding_register] = 1;
+			}
+			else if(holding_register_database[holding_register] > 60000)
+			{
+				holding_register_database[holding_register] = 60000;
+			}
+			break;
+		}
+	}
+}
+
+/*
+ * Keep MB_BAUD_RATE and the MB_BAUD_HIGH / MB_BAUD_LOW pair consistent after a write
+ * A table entry written to MB_BAUD_RATE takes precedence, a rate the USART cannot generate keeps the current rate
+ */
+void handle_baud_rate_range(uint16_t first_register_address, uint16_t last_register_address)
+{
+	if((first_register_address <= MB_BAUD_RATE) && (last_register_address >= MB_BAUD_RATE))
+	{
+		holding_register_database[MB_BAUD_HIGH] = (baud_rate_table[holding_register_database[MB_BAUD_RATE]] >> 16) & 0xFFFF;
+		holding_register_database[MB_BAUD_LOW] = baud_rate_table[holding_register_database[MB_BAUD_RATE]] & 0xFFFF;
+	}
+
+	uint32_t baud_rate = ((uint32_t)holding_register_database[MB_BAUD_HIGH] << 16) | holding_register_database[MB_BAUD_LOW];
+	if(modbus_find_baud_config(baud_rate, modbus_kernel_clock(primary_port), NULL) != MB_SUCCESS)
+	{
+		baud_rate = huart1.Init.BaudRate;
+		holding_register_database[MB_BAUD_HIGH] = (baud_rate >> 16) & 0xFFFF;
+		holding_register_database[MB_BAUD_LOW] = baud_rate & 0xFFFF;
+	}
+
+	holding_register_database[MB_BAUD_RATE] = BAUD_RATE_CUSTOM;
+	for(uint8_t i = BAUD_RATE_2400; i < NUM_BAUD_RATES; i++)
+	{
+		if(baud_rate_table[i] == baud_rate)
+		{
+			holding_register_database[MB_BAUD_RATE] = i;
+		}
+	}
+}
+
+uint8_t modbus_crc_valid()
+{
+	uint16_t rx_frame_len = active_port->rx_frame_len;
+	uint8_t *modbus_rx_buffer = active_port->rx_buffer;
+	if(rx_frame_len < 4 || rx_frame_len > MODBUS_RX_BUFFER_SIZE)
+	{
+		return 0;
+	}
+	uint16_t crc = crc_16(modbus_rx_buffer, rx_frame_len - 2);
+	return (low_byte(crc) == modbus_rx_buffer[rx_frame_len - 2]) && (high_byte(crc) == modbus_rx_buffer[rx_frame_len - 1]);
+}
+
+/*
+ * Returns 1 if a frame starting with this address byte is meant for this board
+ */
+uint8_t modbus_address_match(uint8_t address)
+{
+	return (address == holding_register_database[MODBUS_ID]) || (address == 0xFF) ||
+		   (address == MB_BROADCAST_ADDRESS) || modbus_group_match(address);
+}
+
+/*
+ * Returns 1 if the frame being served was sent to the broadcast address or to a multicast group this board belongs to
+ * The groups are only joined on port 1
+ */
+uint8_t modbus_broadcast_match(uint8_t address)
+{
+	return (address == MB_BROADCAST_ADDRESS) || (active_port == primary_port && modbus_group_match(address));
+}
+
+/*
+ * Slave ID of the port the frame being served arrived on
+ */
+uint8_t modbus_own_id()
+{
+	return (active_port == primary_port) ? holding_register_database[MODBUS_ID] : holding_register_database[MB2_ID];
+}
+
+/*
+ * Port the frame being served arrived on, a modbus_port_id_t
+ */
+uint8_t modbus_rx_port()
+{
+	return active_port - modbus_ports;
+}
+
+uint8_t modbus_group_match(uint8_t address)
+{
+	for(uint8_t i = 0; i < NUM_MODBUS_GROUPS; i++)
+	{
+		if(holding_register_database[MB_GROUP_1 + i] != 0 && holding_register_database[MB_GROUP_1 + i] == address)
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Load the slave and group IDs from the emulated EEPROM, an erased ID keeps its default and an erased group slot is unused
+ */
+void modbus_restore_address()
+{
+	if(ee.modbus_id >= 1 && ee.modbus_id <= MB_MAX_SLAVE_ID)
+	{
+		holding_register_database[MODBUS_ID] = ee.modbus_id;
+	}
+	for(uint8_t i = 0; i < NUM_MODBUS_GROUPS; i++)
+	{
+		holding_register_database[MB_GROUP_1 + i] = (ee.group_id[i] == 0xFF) ? 0 : ee.group_id[i];
+	}
+}
+
+int8_t modbus_store_address()
+{
+	uint8_t changed = 0;
+	if(ee.modbus_id != holding_register_database[MODBUS_ID])
+	{
+		ee.modbus_id = holding_register_database[MODBUS_ID];
+		changed = 1;
+	}
+	for(uint8_t i = 0; i < NUM_MODBUS_GROUPS; i++)
+	{
+		if(ee.group_id[i] != holding_register_database[MB_GROUP_1 + i])
+		{
+			ee.group_id[i] = holding_register_database[MB_GROUP_1 + i];
+			changed = 1;
+		}
+	}
+	if(changed && !EE_Write())
+	{
+		return EE_WRITE_ERROR;
+	}
+	return MB_SUCCESS;
+}
+
+uint8_t modbus_accept_frame(modbus_port_t *port, uint8_t address)
+{
+	if(port != primary_port)
+	{
+		return (address == holding_register_database[MB2_ID]) || (address == 0xFF) || (address == MB_BROADCAST_ADDRESS);
+	}
+	// Any frame on the bus proves the rate while it is being detected or is on probation
+	if(auto_baud_active || baud_switch_state == BAUD_SWITCH_PROBATION)
+	{
+		return 1;
+	}
+	return modbus_address_match(address);
+}
+
+/*
+ * Drop a frame for another board after its header
+ * If the frame is still arriving the receiver is muted until the idle line that ends it, so the body costs no DMA or interrupts
+ */
+void modbus_filter_frame(modbus_port_t *port, uint8_t in_progress)
+{
+	modbus_stats[port - modbus_ports].filtered++;
+	port->counter[MB_COUNT_BUS_MESSAGE]++;
+	if(in_progress)
+	{
+		HAL_MultiProcessor_EnterMuteMode(port->huart);
+		__HAL_UART_SEND_REQ(port->huart, UART_RXDATA_FLUSH_REQUEST);
+	}
+	modbus_port_set_rx(port);
+}
+
+/*
+ * Track receive errors, a detection attempt that produced garbage is restarted straight away,
+ * otherwise detection is only restarted once the errors suggest the master has changed rate
+ */
+void modbus_rx_error()
+{
+	if(holding_register_database[MB_AUTO_BAUD] == AUTO_BAUD_DISABLED)
+	{
+		return;
+	}
+	if(auto_baud_active || ++consecutive_rx_errors >= MODBUS_AUTO_BAUD_ERROR_LIMIT)
+	{
+		consecutive_rx_errors = 0;
+		auto_baud_pending = 1;
+	}
+}
+
+/*
+ * Capture the frame being served, it is traced by modbus_trace_commit() once its outcome is known
+ */
+void modbus_trace_start(modbus_port_t *port, uint8_t result)
+{
+	trace_entry_t *entry = &port->trace;
+	entry->time = port->rx_frame_time;
+	entry->port = port - modbus_ports;
+	entry->id = port->rx_buffer[0];
+	entry->function_code = port->rx_buffer[1];
+	entry->result = result;
+	entry->address = (port->rx_buffer[2] << 8) | port->rx_buffer[3];
+	entry->quantity = (port->rx_buffer[4] << 8) | port->rx_buffer[5];
+	port->trace_pending = 1;
+}
+
+void modbus_trace_commit(modbus_port_t *port, uint16_t response_time)
+{
+	port->trace.response_time = response_time;
+	port->trace_pending = 0;
+	trace_record(&port->trace);
+}
+
+/*
+ * Adopt the rate measured by the auto-baud hardware once a frame has passed its CRC check
+ */
+int8_t modbus_auto_baud_lock()
+{
+	// BRR holds the measured USARTDIV, detection always runs oversampling by 16 without a prescaler
+	uint32_t baud_rate = HAL_RCCEx_GetPeriphCLKFreq(RCC_PERIPHCLK_USART1) / huart1.Instance->BRR;
+
+	// Snap to a standard rate when the measurement is within tolerance of one
+	for(uint8_t i = BAUD_RATE_2400; i < NUM_BAUD_RATES; i++)
+	{
+		uint32_t error = (baud_rate > baud_rate_table[i]) ? (baud_rate - baud_rate_table[i]) : (baud_rate_table[i] - baud_rate);
+		if((uint64_t)error * 1000000 <= (uint64_t)MODBUS_MAX_BAUD_ERROR * baud_rate_table[i])
+		{
+			baud_rate = baud_rate_table[i];
+			break;
+		}
+	}
+
+	auto_baud_active = 0;
+	huart1.AdvancedInit.AutoBaudRateEnable = UART_ADVFEATURE_AUTOBAUDRATE_DISABLE;
+	holding_register_database[MB_AUTO_BAUD] = AUTO_BAUD_ENABLED;
+	holding_register_database[MB_BAUD_HIGH] = (baud_rate >> 16) & 0xFFFF;
+	holding_register_database[MB_BAUD_LOW] = baud_rate & 0xFFFF;
+	handle_baud_rate_range(MB_BAUD_HIGH, MB_BAUD_LOW);
+
+	int8_t status = modbus_change_baud_rate();
+	if(status != MB_SUCCESS)
+	{
+		return status;
+	}
+	return modbus_set_baud_rate(((uint32_t)holding_register_database[MB_BAUD_HIGH] << 16) | holding_register_database[MB_BAUD_LOW]);
+}
+
+/*
+ * A valid frame has been received at the new rate, keep it and store it
+ */
+int8_t modbus_baud_switch_commit()
+{
+	timer_stop(TIMER_MB_BAUD_PROBATION);
+	baud_switch_state = BAUD_SWITCH_IDLE;
+	return modbus_set_baud_rate(huart1.Init.BaudRate);
+}
+
+/*
+ * Apply a pending baud rate once the acknowledgement has completely left the transmitter and no frame is arriving,
+ * then fall back to the previous rate if nothing valid is heard at the new rate within MB_BAUD_PROBATION ms
+ */
+int8_t monitor_baud_switch()
+{
+	int8_t status = MB_SUCCESS;
+
+	if(baud_switch_state == BAUD_SWITCH_PENDING && primary_port->header)
+	{
+		status = modbus_change_baud_rate();
+		if(status != MB_SUCCESS)
+		{
+			baud_switch_state = BAUD_SWITCH_IDLE;
+			return status;
+		}
+		baud_switch_state = BAUD_SWITCH_PROBATION;
+		timer_start(TIMER_MB_BAUD_PROBATION, holding_register_database[MB_BAUD_PROBATION], NULL);
+	}
+	else if(baud_switch_state == BAUD_SWITCH_PROBATION && timer_expired(TIMER_MB_BAUD_PROBATION))
+	{
+		baud_switch_state = BAUD_SWITCH_IDLE;
+		holding_register_database[MB_BAUD_HIGH] = (previous_baud_rate >> 16) & 0xFFFF;
+		holding_register_database[MB_BAUD_LOW] = previous_baud_rate & 0xFFFF;
+		handle_baud_rate_range(MB_BAUD_HIGH, MB_BAUD_LOW);
+		status = modbus_change_baud_rate();
+	}
+	return status;
+}
+#endif // MB_SLAVE
+
+// General Modbus Functions -------------------------------------------------------------------
+
+int8_t modbus_send(uint8_t size)
+{
+	active_port->response_due = 0;
+	if(active_port->trace.result == TRACE_NO_RESPONSE)
+	{
+		active_port->trace.result = TRACE_ANSWERED;
+	}
+	active_port->latency_time[LATENCY_SEND] = timer_now();
+	active_port->latency_state = LATENCY_STATE_SENDING;
+	return modbus_port_send(active_port, size);
+}
+
+/*
+ * Queue a message to be sent once delay ms have elapsed without blocking the caller
+ * The transmission is started by monitor_modbus() when the turnaround timer expires
+ */
+int8_t modbus_send_delayed(uint8_t size, uint32_t delay)
+{
+	active_port->response_due = 0;
+	if(active_port->trace.result == TRACE_NO_RESPONSE)
+	{
+		active_port->trace.result = TRACE_ANSWERED;
+	}
+	active_port->latency_time[LATENCY_SEND] = timer_now();
+	active_port->latency_state = LATENCY_STATE_SENDING;
+	return modbus_port_send_delayed(active_port, size, delay * TIMER_TICKS_PER_MS);
+}
+
+int8_t modbus_reset()
+{
+	return modbus_port_reset(primary_port);
+}
+
+int8_t modbus_set_rx()
+{
+	return modbus_port_set_rx(active_port);
+}
+
+/*
+ * Service every port, the secondary ports first, then the master transaction queue
+ * Secondary port errors are logged in MB_ERRORS, only the status of port 1 is returned since the caller's retry
+ * handling re-sends the slave response held by modbus_send()
+ */
+int8_t monitor_modbus()
+{
+	monitor_port_config();
+	for(uint8_t i = MODBUS_PORT_2; i < NUM_MODBUS_PORTS; i++)
+	{
+		if(modbus_ports[i].role != MODBUS_ROLE_DISABLED)
+		{
+			monitor_port(&modbus_ports[i]);
+		}
+	}
+	int8_t status = monitor_port(primary_port);
+	if(status == MB_TX_TIMEOUT)
+	{
+		// The retry goes out through modbus_send(), which sends on the port of the last frame served
+		active_port = primary_port;
+	}
+#ifdef MB_MASTER
+	// After the ports, so a response collected on this pass is followed straight away by the next request
+	modbus_queue_service();
+#endif
+	return status;
+}
+
+int8_t monitor_port(modbus_port_t *port)
+{
+	int8_t status = MB_SUCCESS;
+
+	if(port->latency_state == LATENCY_STATE_SENT)
+	{
+#ifdef MB_SLAVE
+		if(port->trace_pending)
+		{
+			uint32_t response_time = port->latency_time[LATENCY_TX_COMPLETE] - port->latency_time[LATENCY_FRAME_END];
+			modbus_trace_commit(port, (response_time > 0xFFFE) ? 0xFFFE : response_time);
+		}
+#endif
+		modbus_record_latency(port);
+	}
+
+	// Chunk miss handling
+	status = handle_chunk_miss(port);
+	if(status != MB_SUCCESS)
+	{
+#ifdef MB_SLAVE
+		if(port == primary_port)
+		{
+			modbus_rx_error();
+		}
+#endif
+		status = modbus_port_reset(port);
+		if(status != MB_SUCCESS)
+		{
+			return status;
+		}
+		return handle_modbus_error(MB_UART_ERROR);
+	}
+
+	// Uart error handling
+	if(port->err_int)
+	{
+		port->err_int = 0;
+#ifdef MB_SLAVE
+		if(port == primary_port)
+		{
+			modbus_rx_error();
+		}
+#endif
+		status = modbus_port_reset(port);
+		if(status != MB_SUCCESS)
+		{
+			return status;
+		}
+		return handle_modbus_error(MB_UART_ERROR);
+	}
+
+	// Delayed transmission handling
+	if(timer_expired(port->turnaround_timer))
+	{
+		status = modbus_start_tx(port, port->tx_pending_len);
+		port->tx_pending_len = 0;
+		if(status != HAL_OK)
+		{
+			port->tx_int = 1;
+			timer_stop(port->tx_timer);
+			return handle_modbus_error(MB_UART_ERROR);
+		}
+	}
+
+	// TX timeout handling
+	if(!port->tx_int)
+	{
+		if(timer_expired(port->tx_timer))
+		{
+			port->tx_int = 1;
+			timer_stop(port->turnaround_timer);
+			port->tx_pending_len = 0;
+			return handle_modbus_error(MB_TX_TIMEOUT);
+		}
+		status = HAL_BUSY;
+	}
+#ifdef MB_SLAVE
+	else if(port != primary_port)
+	{
+		// Baud rate switching and auto-baud detection only apply to port 1
+	}
+	else if(baud_switch_state != BAUD_SWITCH_IDLE)
+	{
+		status = monitor_baud_switch();
+		if(status != MB_SUCCESS)
+		{
+			return status;
+		}
+	}
+	else if(auto_baud_pending)
+	{
+		auto_baud_pending = 0;
+		status = modbus_auto_baud_start();
+		if(status != MB_SUCCESS)
+		{
+			return status;
+		}
+	}
+#endif
+
+#ifdef MB_MASTER
+	// RX timeout handling
+	if(port->role == MODBUS_ROLE_MASTER && port->expected_rx_len > 0)
+	{
+		if(port->rx_int)
+		{
+			port->rx_int = 0;
+			timer_stop(port->rx_timer);
+			uint8_t function_code = port->target_function_code;
+			status = modbus_mic(port->target_id, function_code, port->rx_frame_len);
+			port->result = status;
+			port->target_id = 0;
+			port->target_function_code = 0;
+			port->expected_rx_len = 0;
+			if(status == MB_SUCCESS)
+			{
+				port->response_rx = 1;
+				if(function_code == 0x03 || function_code == 0x04)
+				{
+					store_rx_buffer();
+				}
+				return status;
+			}
+			return handle_modbus_error(MB_UART_ERROR);
+		}
+		else
+		{
+			if(timer_expired(port->rx_timer))
+			{
+				port->result = MB_RX_TIMEOUT;
+				port->target_id = 0;
+				port->target_function_code = 0;
+				port->expected_rx_len = 0;
+				return handle_modbus_error(MB_RX_TIMEOUT);
+			}
+			status = HAL_BUSY;
+		}
+	}
+#endif
+	return status;
+}
+
+/*
+ * Apply a new MB2_ROLE or MB2_BAUD_RATE to USART2 once nothing is in flight on it
+ * A master giving up the port drops its queue, the schedule is kept for when the role comes back
+ */
+void monitor_port_config()
+{
+	modbus_port_t *port = &modbus_ports[MODBUS_PORT_2];
+	uint8_t role = holding_register_database[MB2_ROLE];
+	if(!modbus_port_quiet(port))
+	{
+		return;
+	}
+	if(role == port->role && holding_register_database[MB2_BAUD_RATE] == port_2_baud_rate)
+	{
+		if(port->clock_stale)
+		{
+			modbus_port_reclock(port);
+		}
+		return;
+	}
+#ifdef MB_MASTER
+	if(port->role == MODBUS_ROLE_MASTER && role != MODBUS_ROLE_MASTER)
+	{
+		modbus_queue_flush();
+	}
+#endif
+	port->role = role;
+	port_2_baud_rate = holding_register_database[MB2_BAUD_RATE];
+
+	uint32_t baud_rate = baud_rate_table[port_2_baud_rate];
+	baud_config_t config;
+	if(modbus_find_baud_config(baud_rate, modbus_kernel_clock(port), &config) != MB_SUCCESS)
+	{
+		handle_modbus_error(RANGE_ERROR);
+		return;
+	}
+	// Resets the port for the new role, a disabled port is left idle at MB2_BAUD_RATE for the telemetry stream
+	port->clock_stale = 0;
+	modbus_port_set_baud_rate(port, baud_rate, &config);
+}
+
+/*
+ * Returns 1 if the port has nothing being received, transmitted or waited for
+ * A disabled port may still be sending a telemetry record
+ */
+uint8_t modbus_port_quiet(modbus_port_t *port)
+{
+	if(port->role == MODBUS_ROLE_DISABLED)
+	{
+		return port->huart->gState == HAL_UART_STATE_READY;
+	}
+	uint8_t quiet = port->header && port->tx_int && !port->tx_pending_len && !port->rx_int;
+#ifdef MB_MASTER
+	if(port->role == MODBUS_ROLE_MASTER)
+	{
+		quiet = quiet && (port->expected_rx_len == 0) && !queue_active;
+	}
+#endif
+	return quiet;
+}
+
+/*
+ * Recalculate the baud rate generator of a port for the current kernel clock, resets the port
+ */
+int8_t modbus_port_reclock(modbus_port_t *port)
+{
+	baud_config_t config;
+	port->clock_stale = 0;
+	if(modbus_find_baud_config(port->huart->Init.BaudRate, modbus_kernel_clock(port), &config) != MB_SUCCESS)
+	{
+		return handle_modbus_error(RANGE_ERROR);
+	}
+	if(modbus_port_set_baud_rate(port, port->huart->Init.BaudRate, &config) != HAL_OK)
+	{
+		return handle_modbus_error(MB_FATAL_ERROR);
+	}
+	return MB_SUCCESS;
+}
+
+/*
+ * Returns 1 if USART2 can take this role in this build
+ */
+uint8_t modbus_port_2_role_valid(uint8_t role)
+{
+	switch(role)
+	{
+		case MODBUS_ROLE_DISABLED:
+#ifdef MB_SLAVE
+		case MODBUS_ROLE_SLAVE:
+#endif
+#if defined(MB_SLAVE) && defined(MB_MASTER)
+		case MODBUS_ROLE_MASTER:
+#endif
+		{
+			return 1;
+		}
+		default:
+		{
+			return 0;
+		}
+	}
+}
+
+// General Modbus Control Functions ------------------------------------------------------------
+
+int8_t modbus_startup()
+{
+	// Secondary ports log their own failures in MB_ERRORS
+	for(uint8_t i = MODBUS_PORT_2; i < NUM_MODBUS_PORTS; i++)
+	{
+		modbus_port_t *port = &modbus_ports[i];
+		if(port->role == MODBUS_ROLE_DISABLED)
+		{
+			continue;
+		}
+#ifdef MB_MASTER
+		port->expected_rx_len = 0;
+		timer_stop(port->rx_timer);
+#endif
+		port->err_int = 0;
+		modbus_port_reset(port);
+	}
+	primary_port->err_int = 0;
+	return modbus_reset();
+}
+
+int8_t modbus_shutdown()
+{
+	int8_t status = HAL_OK;
+	for(uint8_t i = 0; i < NUM_MODBUS_PORTS; i++)
+	{
+		modbus_port_t *port = &modbus_ports[i];
+		if(port->role == MODBUS_ROLE_DISABLED)
+		{
+			continue;
+		}
+		timer_stop(port->chunk_timer);
+		timer_stop(port->turnaround_timer);
+		timer_stop(port->rx_timer);
+#ifdef MB_FIFO_MODE
+		if(port->fifo_rx)
+		{
+			__HAL_UART_DISABLE_IT(port->huart, UART_IT_RXFT);
+			__HAL_UART_DISABLE_IT(port->huart, UART_IT_RTO);
+		}
+#endif
+		status |= HAL_UART_AbortReceive(port->huart);
+	}
+	return status;
+}
+
+/*
+ * Returns 1 if the modbus has an event that monitor_modbus() or the application has not yet handled
+ */
+uint8_t modbus_work_pending()
+{
+	for(uint8_t i = 0; i < NUM_MODBUS_PORTS; i++)
+	{
+		if(modbus_ports[i].rx_int || modbus_ports[i].err_int)
+		{
+			return 1;
+		}
+	}
+#ifdef MB_MASTER
+	// The transaction on the bus has finished, its result is waiting to be collected
+	if(queue_active && modbus_master_idle())
+	{
+		return 1;
+	}
+#endif
+	return ((baud_switch_state == BAUD_SWITCH_PENDING && primary_port->header) || auto_baud_pending) && primary_port->tx_int;
+}
+
+/*
+ * Returns 1 if no message is being received or transmitted, so the core may stop its clocks
+ * A slave on USART2 keeps the clocks running, it has no way to wake the core from Stop
+ * Auto-baud detection times the start bit with the kernel clock, which is not running when a start bit wakes the core from Stop
+ */
+uint8_t modbus_bus_idle()
+{
+	for(uint8_t i = 0; i < NUM_MODBUS_PORTS; i++)
+	{
+		modbus_port_t *port = &modbus_ports[i];
+		if(port->role != MODBUS_ROLE_DISABLED &&
+		  (!port->header || !port->tx_int || port->tx_pending_len || port->rx_int))
+		{
+			return 0;
+		}
+		// A start bit on a USART that cannot wake the core from Stop would be lost, and its baud rate follows PCLK
+		if(port->role == MODBUS_ROLE_SLAVE && !IS_UART_WAKEUP_FROMSTOP_INSTANCE(port->huart->Instance))
+		{
+			return 0;
+		}
+#ifdef MB_MASTER
+		// A response may still be on its way
+		if(port->role == MODBUS_ROLE_MASTER && port->expected_rx_len > 0)
+		{
+			return 0;
+		}
+#endif
+	}
+	return !auto_baud_active;
+}
+
+/*
+ * Apply the rate held in MB_BAUD_HIGH / MB_BAUD_LOW
+ * The oversampling mode and kernel clock prescaler are chosen for the lowest error, which is reported
+ * through modbus_get_baud_rate_error()
+ */
+int8_t modbus_change_baud_rate()
+{
+	uint32_t baud_rate = ((uint32_t)holding_register_database[MB_BAUD_HIGH] << 16) | holding_register_database[MB_BAUD_LOW];
+	uint32_t kernel_clock = modbus_kernel_clock(primary_port);
+	baud_config_t config;
+
+	int8_t status = modbus_find_baud_config(baud_rate, kernel_clock, &config);
+	if(status != MB_SUCCESS)
+	{
+		holding_register_database[MB_BAUD_RATE] = BAUD_RATE_9600;
+		holding_register_database[MB_BAUD_HIGH] = 0;
+		holding_register_database[MB_BAUD_LOW] = 9600;
+		baud_rate = 9600;
+		modbus_find_baud_config(baud_rate, kernel_clock, &config);
+	}
+
+	int8_t reset_status = modbus_port_set_baud_rate(primary_port, baud_rate, &config);
+	if(reset_status != HAL_OK)
+	{
+		return reset_status;
+	}
+	if(status != MB_SUCCESS)
+	{
+		return handle_modbus_error(RANGE_ERROR);
+	}
+	return MB_SUCCESS;
+}
+
+/*
+ * Recalculate the baud rate generators after a system clock change
+ * USART1 runs from the HSI kernel clock, so it only has work to do if it is moved back onto PCLK or SYSCLK
+ * USART2 has no kernel clock mux and always follows PCLK, it is only reset once it is quiet so a poll or telemetry
+ * record in flight is not aborted. Transmissions raise the clock with clock_wake() first, so this is rare
+ */
+int8_t modbus_clock_changed()
+{
+	int8_t status = MB_SUCCESS;
+	for(uint8_t i = MODBUS_PORT_2; i < NUM_MODBUS_PORTS; i++)
+	{
+		modbus_port_t *port = &modbus_ports[i];
+		port->clock_stale = 1;
+		if(modbus_port_quiet(port))
+		{
+			int8_t port_status = modbus_port_reclock(port);
+			status = (port_status != MB_SUCCESS) ? port_status : status;
+		}
+	}
+
+	if(__HAL_RCC_GET_USART1_SOURCE() == RCC_USART1CLKSOURCE_HSIKER)
+	{
+		return status;
+	}
+	int8_t primary_status = modbus_change_baud_rate();
+	return (primary_status != MB_SUCCESS) ? primary_status : status;
+}
+
+/*
+ * Role a port is running in, a modbus_role_t
+ */
+uint8_t modbus_port_role(uint8_t port)
+{
+	return (port < NUM_MODBUS_PORTS) ? modbus_ports[port].role : MODBUS_ROLE_DISABLED;
+}
+
+/*
+ * Load the USART2 role, slave ID and baud rate from the emulated EEPROM, an erased or invalid value keeps its default
+ * The role is taken up by modbus_startup(), the baud rate by the first monitor_modbus()
+ */
+void modbus_restore_port_config()
+{
+	if(ee.mb2_baud_rate >= BAUD_RATE_4800 && ee.mb2_baud_rate < NUM_BAUD_RATES)
+	{
+		holding_register_database[MB2_BAUD_RATE] = ee.mb2_baud_rate;
+	}
+	if(ee.mb2_id >= 1 && ee.mb2_id <= MB_MAX_SLAVE_ID)
+	{
+		holding_register_database[MB2_ID] = ee.mb2_id;
+	}
+	if(modbus_port_2_role_valid(ee.mb2_role))
+	{
+		holding_register_database[MB2_ROLE] = ee.mb2_role;
+	}
+	modbus_ports[MODBUS_PORT_2].role = holding_register_database[MB2_ROLE];
+}
+
+int8_t modbus_store_port_config()
+{
+	if(ee.mb2_baud_rate == holding_register_database[MB2_BAUD_RATE] &&
+	   ee.mb2_role == holding_register_database[MB2_ROLE] &&
+	   ee.mb2_id == holding_register_database[MB2_ID])
+	{
+		return MB_SUCCESS;
+	}
+	ee.mb2_baud_rate = holding_register_database[MB2_BAUD_RATE];
+	ee.mb2_role = holding_register_database[MB2_ROLE];
+	ee.mb2_id = holding_register_database[MB2_ID];
+	if(!EE_Write())
+	{
+		return EE_WRITE_ERROR;
+	}
+	return MB_SUCCESS;
+}
+
+uint32_t modbus_get_actual_baud_rate()
+{
+	return primary_port->baud_config.actual_baud_rate;
+}
+
+int32_t modbus_get_baud_rate_error()
+{
+	return primary_port->baud_config.error;
+}
+
+/*
+ * Store the baud rate in the emulated EEPROM so it survives a power cycle
+ */
+int8_t modbus_set_baud_rate(uint32_t baud_rate)
+{
+	if(ee.modbus_baud_rate != baud_rate)
+	{
+		ee.modbus_baud_rate = baud_rate;
+
+		if(!EE_Write())
+		{
+			return EE_WRITE_ERROR;
+		}
+	}
+	return HAL_OK;
+}
+
+int8_t modbus_get_baud_rate(uint32_t* baud_rate)
+{
+	*baud_rate = ee.modbus_baud_rate;
+	return HAL_OK;
+}
+
+uint32_t modbus_get_table_baud_rate(uint8_t baud_rate)
+{
+	return (baud_rate < NUM_BAUD_RATES) ? baud_rate_table[baud_rate] : 0;
+}
+
+/*
+ * Bring the modbus up at the stored baud rate
+ * A board that has never had a rate stored listens for the master's rate instead when auto-baud is enabled
+ */
+int8_t modbus_restore_baud_rate()
+{
+	uint32_t baud_rate = 0;
+	modbus_get_baud_rate(&baud_rate);
+
+	if(modbus_find_baud_config(baud_rate, modbus_kernel_clock(primary_port), NULL) == MB_SUCCESS)
+	{
+		holding_register_database[MB_BAUD_HIGH] = (baud_rate >> 16) & 0xFFFF;
+		holding_register_database[MB_BAUD_LOW] = baud_rate & 0xFFFF;
+#ifdef MB_SLAVE
+		handle_baud_rate_range(MB_BAUD_HIGH, MB_BAUD_LOW);
+#endif
+		return modbus_change_baud_rate();
+	}
+	if(holding_register_database[MB_AUTO_BAUD] != AUTO_BAUD_DISABLED)
+	{
+		return modbus_auto_baud_start();
+	}
+	return modbus_reset();
 }
-#endif // MB_SLAVE
 
-// General Modbus Functions -------------------------------------------------------------------
+/*
+ * Restart USART1 with hardware auto-baud detection armed on the start bit of the next byte
+ */
+int8_t modbus_auto_baud_start()
+{
+	// Detection supersedes any baud rate switch in progress
+	baud_switch_state = BAUD_SWITCH_IDLE;
+	timer_stop(TIMER_MB_BAUD_PROBATION);
+	auto_baud_active = 1;
+	holding_register_database[MB_AUTO_BAUD] = AUTO_BAUD_DETECT;
+	huart1.Init.OverSampling = UART_OVERSAMPLING_16;
+	huart1.Init.ClockPrescaler = UART_PRESCALER_DIV1;
+	huart1.AdvancedInit.AdvFeatureInit |= UART_ADVFEATURE_AUTOBAUDRATE_INIT;
+	huart1.AdvancedInit.AutoBaudRateEnable = UART_ADVFEATURE_AUTOBAUDRATE_ENABLE;
+	huart1.AdvancedInit.AutoBaudRateMode = UART_ADVFEATURE_AUTOBAUDRATE_ONSTARTBIT;
+	return modbus_reset();
+}
 
-int8_t modbus_send(uint8_t size)
+
+// Low Level Functions -------------------------------------------------------------------------
+uint8_t get_rx_buffer(uint8_t index)
 {
-	int8_t status = HAL_OK;
-	// Append CRC (low byte then high byte)
-	uint16_t crc = crc_16(modbus_tx_buffer, size);
-	modbus_tx_buffer[size] = low_byte(crc);
-	modbus_tx_buffer[size + 1] = high_byte(crc);
-
-	uart_tx_int = 0; // This will enable tx timeout monitoring
-	tx_time = HAL_GetTick();
-	status = HAL_UART_Transmit_DMA(&huart1, modbus_tx_buffer, size + 2);
-	__HAL_DMA_DISABLE_IT(huart1.hdmatx, DMA_IT_HT);
-	return status;
+	if (index < MODBUS_RX_BUFFER_SIZE)
+	{
+		return active_port->rx_buffer[index];
+	}
+	return 0xFF;
 }
 
-int8_t modbus_reset()
+/*
+ * Count the error, codes from RANGE_ERROR up also keep setting their bit in the MB_ERRORS summary
+ */
+int8_t handle_modbus_error(int8_t error_code)
 {
-	int8_t status = 0;
-	// Reset interrupt variables to default state
-	uart_tx_int = 1;
-	uart_rx_int = 0;
-	status = HAL_UART_Abort(&huart1);
-	status |= HAL_UART_DeInit(&huart1);
-	__USART1_FORCE_RESET();
-	HAL_Delay(100);
-	__USART1_RELEASE_RESET();
-	status = HAL_RS485Ex_Init(&huart1, UART_DE_POLARITY_HIGH, 0, 0);
-	status |= HAL_UARTEx_SetTxFifoThreshold(&huart1, UART_TXFIFO_THRESHOLD_1_8);
-	status |= HAL_UARTEx_SetRxFifoThreshold(&huart1, UART_RXFIFO_THRESHOLD_1_8);
-	status |= HAL_UARTEx_DisableFifoMode(&huart1);
-	status |= modbus_set_rx();
-	if(status != HAL_OK)
+	diag_count(error_code);
+	if(error_code >= RANGE_ERROR && error_code <= EE_WRITE_ERROR)
 	{
-		return handle_modbus_error(MB_FATAL_ERROR);
+		holding_register_database[MB_ERRORS] |= 1U << (error_code - RANGE_ERROR);
 	}
-	return status;
+	else if(error_code >= HAL_ERROR && error_code <= HAL_TIMEOUT)
+	{
+		holding_register_database[MB_ERRORS] |= 1U << MB_ERRORS_HAL_BIT;
+	}
+	return error_code;
 }
 
-int8_t modbus_set_rx()
+// Private Functions ---------------------------------------------------------------------------
+
+#ifdef MB_SLAVE
+int8_t return_registers(uint16_t *register_database, uint16_t num_database_registers, uint8_t *tx_len)
 {
-	int8_t status = HAL_UARTEx_ReceiveToIdle_DMA(&huart1, modbus_rx_buffer, 6);
-	__HAL_DMA_DISABLE_IT(huart1.hdmarx, DMA_IT_HT);
+	uint8_t *modbus_tx_buffer = active_port->tx_buffer;
+	(*tx_len) = 0;
+	// Handle Error Checking
+	uint16_t first_register_address = (get_rx_buffer(2) << 8) | get_rx_buffer(3);
 
-	return status;
+	// Get the number of registers requested by the master
+	uint16_t num_registers = (get_rx_buffer(4) << 8) | get_rx_buffer(5);
+
+	if(num_registers > RX_BUFFER_SIZE || num_registers < 1) // 125 is the limit according to modbus protocol
+	{
+		return modbus_exception(MB_ILLEGAL_DATA_VALUE);
+	}
+
+	uint16_t last_register_address = first_register_address + (num_registers - 1);
+
+	if(last_register_address >= num_database_registers)
+	{
+		return modbus_exception(MB_ILLEGAL_DATA_ADDRESS);
+	}
+
+	// Return register values
+	modbus_tx_buffer[0] = get_rx_buffer(0); // Append Slave id
+	modbus_tx_buffer[1] = get_rx_buffer(1); // Append Function Code
+	modbus_tx_buffer[2] = num_registers * 2; // Append number of bytes
+	(*tx_len) = 3;
+
+	// Append the Register Values
+	for(uint8_t i = 0; i < num_registers; i++)
+	{
+		modbus_tx_buffer[(*tx_len)++] = high_byte(register_database[first_register_address + i]);
+		modbus_tx_buffer[(*tx_len)++] = low_byte(register_database[first_register_address + i]);
+	}
+
+	return modbus_send((*tx_len));
 }
 
-int8_t monitor_modbus()
+/*
+ * Bit of the UID counted from the most significant bit of the first byte
+ */
+uint8_t modbus_uid_bit(const uint8_t *uid, uint8_t bit)
 {
-	int8_t status = MB_SUCCESS;
+	return (uid[bit / 8] >> (7 - bit % 8)) & 0x01;
+}
 
-	// Chunk miss handling
-	status = handle_chunk_miss();
-	if(status != MB_SUCCESS)
+/*
+ * Time in ms to send one enumeration response at the current baud rate, 11 bits a character covers any parity setting
+ */
+uint32_t modbus_enumerate_slot()
+{
+	uint32_t frame_bits = (6 + MB_UID_SIZE + 2) * 11;
+	uint32_t baud_rate = active_port->huart->Init.BaudRate;
+	return ((frame_bits * 1000U) + baud_rate - 1) / baud_rate + MODBUS_TURNAROUND_DELAY;
+}
+#endif // MB_SLAVE
+
+modbus_port_t *modbus_port_lookup(UART_HandleTypeDef *huart)
+{
+	for(uint8_t i = 0; i < NUM_MODBUS_PORTS; i++)
 	{
-		status = modbus_reset();
-		if(status != MB_SUCCESS)
+		if(modbus_ports[i].huart == huart && modbus_ports[i].role != MODBUS_ROLE_DISABLED)
 		{
-			return status;
+			return &modbus_ports[i];
 		}
-		return handle_modbus_error(MB_UART_ERROR);
 	}
+	return NULL;
+}
 
-	// Uart error handling
-	if(uart_err_int)
+int8_t modbus_port_send(modbus_port_t *port, uint8_t size)
+{
+	// Append CRC (low byte then high byte)
+	uint16_t crc = crc_16(port->tx_buffer, size);
+	port->tx_buffer[size] = low_byte(crc);
+	port->tx_buffer[size + 1] = high_byte(crc);
+
+	port->tx_int = 0; // This will enable tx timeout monitoring
+	timer_start(port->tx_timer, holding_register_database[MB_TRANSMIT_TIMEOUT], NULL);
+	return modbus_start_tx(port, size + 2);
+}
+
+int8_t modbus_port_send_delayed(modbus_port_t *port, uint8_t size, uint32_t delay_us)
+{
+	// Append CRC (low byte then high byte)
+	uint16_t crc = crc_16(port->tx_buffer, size);
+	port->tx_buffer[size] = low_byte(crc);
+	port->tx_buffer[size + 1] = high_byte(crc);
+
+	port->tx_int = 0; // This will enable tx timeout monitoring
+	port->tx_pending_len = size + 2;
+	timer_start_us(port->tx_timer, holding_register_database[MB_TRANSMIT_TIMEOUT] * TIMER_TICKS_PER_MS + delay_us, NULL);
+	timer_start_us(port->turnaround_timer, delay_us, NULL);
+	return MB_SUCCESS;
+}
+
+int8_t modbus_port_set_rx(modbus_port_t *port)
+{
+#ifdef MB_FIFO_MODE
+	if(port->fifo_rx)
 	{
-		uart_err_int = 0;
-		status = modbus_reset();
-		if(status != MB_SUCCESS)
-		{
-			return status;
-		}
-		return handle_modbus_error(MB_UART_ERROR);
+		port->rx_index = 0;
+		port->rx_discard = 0;
+		__HAL_UART_SEND_REQ(port->huart, UART_RXDATA_FLUSH_REQUEST);
+		__HAL_UART_CLEAR_FLAG(port->huart, UART_CLEAR_RTOF);
+		__HAL_UART_ENABLE_IT(port->huart, UART_IT_RXFT);
+		__HAL_UART_ENABLE_IT(port->huart, UART_IT_RTO);
+		__HAL_UART_ENABLE_IT(port->huart, UART_IT_ERR);
+		return HAL_OK;
 	}
+#endif
+	int8_t status = HAL_UARTEx_ReceiveToIdle_DMA(port->huart, port->rx_buffer, 6);
+	__HAL_DMA_DISABLE_IT(port->huart->hdmarx, DMA_IT_HT);
 
-	// TX timeout handling
-	if(!uart_tx_int)
+	return status;
+}
+
+int8_t modbus_port_reset(modbus_port_t *port)
+{
+	int8_t status = 0;
+	// Reset interrupt variables to default state
+	port->tx_int = 1;
+	port->rx_int = 0;
+	port->header = 1;
+	port->tx_pending_len = 0;
+	timer_stop(port->tx_timer);
+	timer_stop(port->turnaround_timer);
+	timer_stop(port->chunk_timer);
+	status = HAL_UART_Abort(port->huart);
+	status |= HAL_UART_DeInit(port->huart);
+	// The reset pulse only needs to be held for a bus clock cycle
+	if(port->huart->Instance == USART1)
 	{
-		if(HAL_GetTick() - tx_time >= holding_register_database[MB_TRANSMIT_TIMEOUT])
-		{
-			uart_tx_int = 1;
-			return handle_modbus_error(MB_TX_TIMEOUT);
-		}
-		status = HAL_BUSY;
+		__USART1_FORCE_RESET();
+		__USART1_RELEASE_RESET();
 	}
-
-#ifdef MB_MASTER
-	// RX timeout handling
-	if(expected_rx_len > 0)
+	else
 	{
-		if(uart_rx_int)
-		{
-			uart_rx_int = 0;
-			status = modbus_mic(target_id, target_function_code, expected_rx_len);
-			target_id = 0;
-			target_function_code = 0;
-			expected_rx_len = 0;
-			if(status == MB_SUCCESS)
-			{
-				response_rx = 1;
-				if(target_function_code == 0x03)
-				{
-					store_rx_buffer();
-				}
-				return status;
-			}
-			return handle_modbus_error(MB_UART_ERROR);
-		}
-		else
+		__USART2_FORCE_RESET();
+		__USART2_RELEASE_RESET();
+	}
+	status = HAL_RS485Ex_Init(port->huart, UART_DE_POLARITY_HIGH, 0, 0);
+	port->char_time = (11U * 1000000U) / port->huart->Init.BaudRate; // 11 bits a character covers any parity setting
+	port->latency_state = LATENCY_STATE_IDLE;
+	if(IS_UART_FIFO_INSTANCE(port->huart->Instance))
+	{
+		status |= modbus_configure_fifo(port);
+	}
+	if(IS_UART_WAKEUP_FROMSTOP_INSTANCE(port->huart->Instance))
+	{
+		// Set up once here, before reception starts, idle_stop() only enables Stop mode and the WUF interrupt
+		// The USART kernel clock (HSIKER) is requested on demand
+		UART_WakeUpTypeDef wakeup = {0};
+		wakeup.WakeUpEvent = UART_WAKEUP_ON_STARTBIT;
+		status |= HAL_UARTEx_StopModeWakeUpSourceConfig(port->huart, wakeup);
+	}
+#ifdef MB_SLAVE
+	if(port->role == MODBUS_ROLE_SLAVE)
+	{
+		// Mute mode wakes on an idle line (WAKE is cleared by the peripheral reset), used to skip frames for other boards
+		status |= HAL_MultiProcessor_EnableMuteMode(port->huart);
+	}
+#endif
+	if(port->role != MODBUS_ROLE_DISABLED)
+	{
+		status |= modbus_port_set_rx(port);
+	}
+	if(status != HAL_OK)
+	{
+		// The super-loop retries a failed reset until it succeeds, only the first failure is journaled
+		if(!port->fatal_logged)
 		{
-			if(HAL_GetTick() - rx_time >= response_interval)
-			{
-				target_id = 0;
-				target_function_code = 0;
-				expected_rx_len = 0;
-				return handle_modbus_error(MB_RX_TIMEOUT);
-			}
-			status = HAL_BUSY;
+			port->fatal_logged = 1;
+			journal_log(JOURNAL_UART_FATAL, port - modbus_ports, (uint8_t)status);
 		}
+		return handle_modbus_error(MB_FATAL_ERROR);
 	}
-#endif
+	port->fatal_logged = 0;
 	return status;
 }
 
-// General Modbus Control Functions ------------------------------------------------------------
-
-int8_t modbus_startup()
+int8_t modbus_port_set_baud_rate(modbus_port_t *port, uint32_t baud_rate, const baud_config_t *config)
 {
-	uart_err_int = 0;
-	return modbus_reset();
+	port->baud_config = (*config);
+	port->huart->Init.BaudRate = baud_rate;
+	port->huart->Init.OverSampling = config->over_sampling;
+	port->huart->Init.ClockPrescaler = config->prescaler;
+
+	// The BRR, OVER8 and PRESC fields can only be written while the USART is disabled, so reinitialise it
+	return modbus_port_reset(port);
 }
 
-int8_t modbus_shutdown()
+int8_t modbus_start_tx(modbus_port_t *port, uint8_t len)
 {
-	return HAL_UART_AbortReceive(&huart1);
+	int8_t status = HAL_UART_Transmit_DMA(port->huart, port->tx_buffer, len);
+	__HAL_DMA_DISABLE_IT(port->huart->hdmatx, DMA_IT_HT);
+	return status;
 }
 
-int8_t modbus_change_baud_rate()
+/*
+ * Common frame extractor hooks, called by the DMA and FIFO receive paths
+ */
+/*
+ * chars: characters already received, the frame is timed from its first byte
+ */
+void modbus_frame_start(modbus_port_t *port, uint8_t chars)
 {
-	int8_t status = 0;
+	port->rx_start_time = timer_now() - port->char_time * chars;
+	// Arm the chunk miss timer in case the body of the message never arrives
+	timer_start(port->chunk_timer, MODBUS_CHUNK_TIMEOUT, NULL);
+	port->header = 0;
+	port->irq_count = 1;
+}
 
-	switch(holding_register_database[MB_BAUD_RATE])
+/*
+ * Bytes of a request left to receive after its MODBUS_HEADER_CHARS header, CRC included
+ * Function codes without a length in the header get the whole buffer, the idle line ends their frame
+ */
+uint32_t modbus_request_body(const uint8_t *header)
+{
+	uint32_t body = MODBUS_RX_BUFFER_SIZE - MODBUS_HEADER_CHARS;
+	switch(header[1])
 	{
-		case BAUD_RATE_2400:
-		{
-			huart1.Init.BaudRate = 2400;
-			break;
-		}
-		case BAUD_RATE_4800:
-		{
-			huart1.Init.BaudRate = 4800;
-			break;
-		}
-		case BAUD_RATE_9600:
-		{
-			huart1.Init.BaudRate = 9600;
-			break;
-		}
-		case BAUD_RATE_19200:
-		{
-			huart1.Init.BaudRate = 19200;
-			break;
-		}
-		case BAUD_RATE_38400:
-		{
-			huart1.Init.BaudRate = 38400;
-			break;
-		}
-		case BAUD_RATE_57600:
+		case 0x03:
+		case 0x04:
 		{
-			huart1.Init.BaudRate = 57600;
+			body = 2;
 			break;
 		}
-		case BAUD_RATE_115200:
+		case 0x10:
 		{
-			huart1.Init.BaudRate = 115200;
+			// Byte count, the registers and the CRC, header bytes 4 and 5 hold the quantity
+			body = ((uint32_t)((header[4] << 8) | header[5])) * 2 + 1 + 2;
 			break;
 		}
-		case BAUD_RATE_128000:
+		case MB_READ_FILE_RECORD:
 		{
-			huart1.Init.BaudRate = 128000;
+			// Header byte 2 counts the bytes of the sub-requests, 3 of which are already in the header
+			body = (header[2] > 3) ? header[2] - 3 + 2 : 2;
 			break;
 		}
-		case BAUD_RATE_256000:
+	}
+	if(body > MODBUS_RX_BUFFER_SIZE - MODBUS_HEADER_CHARS)
+	{
+		body = MODBUS_RX_BUFFER_SIZE - MODBUS_HEADER_CHARS;
+	}
+	return body;
+}
+
+void modbus_frame_complete(modbus_port_t *port, uint16_t len)
+{
+	/*
+	 * This is where the message officially completes being received
+	 * For Masters: Don't set up a reception, modbus stays in idle until you transmit a command again
+	 * For Slaves: Don't set up reception since you will need to transmit a response first
+	 * Use modbus_set_rx(); as the user to re-enable receive mode
+	 */
+	modbus_stats_t *stats = &modbus_stats[port - modbus_ports];
+	timer_stop(port->chunk_timer);
+	port->rx_frame_time = timer_now();
+	port->idle_since = port->rx_frame_time;
+	port->rx_frame_len = len;
+	port->header = 1;
+	port->rx_int = 1;
+	port->counter[MB_COUNT_BUS_MESSAGE]++;
+
+	stats->frames++;
+	stats->irq_per_frame = port->irq_count;
+	if(port->irq_count > stats->irq_per_frame_max)
+	{
+		stats->irq_per_frame_max = port->irq_count;
+	}
+}
+
+#ifdef MB_FIFO_MODE
+void modbus_fifo_rx(modbus_port_t *port)
+{
+	uint32_t isrflags = port->huart->Instance->ISR;
+
+	// Drain everything waiting in the FIFO, not just the threshold amount
+	while(__HAL_UART_GET_FLAG(port->huart, UART_FLAG_RXFNE))
+	{
+		uint8_t data = (uint8_t)port->huart->Instance->RDR;
+		if(port->rx_discard)
 		{
-			huart1.Init.BaudRate = 256000;
-			break;
+			continue;
 		}
-		default:
+		if(port->rx_index == 0)
 		{
-			holding_register_database[MB_BAUD_RATE] = BAUD_RATE_9600;
-			huart1.Init.BaudRate = 9600;
-			status = UART_SetConfig(&huart1);
-			if(status == HAL_OK)
+#ifdef MB_SLAVE
+			// The rest of a frame for another board is drained and discarded until the receiver timeout
+			if(port->role == MODBUS_ROLE_SLAVE && !modbus_accept_frame(port, data))
 			{
-				status = modbus_reset();
-				if(status != HAL_OK)
-				{
-					return status;
-				}
+				modbus_stats[port - modbus_ports].filtered++;
+				port->counter[MB_COUNT_BUS_MESSAGE]++;
+				port->rx_discard = 1;
+				continue;
 			}
-			return handle_modbus_error(RANGE_ERROR);
+#endif
+			modbus_frame_start(port, MODBUS_RX_FIFO_CHARS);
+		}
+		if(port->rx_index < MODBUS_RX_BUFFER_SIZE)
+		{
+			port->rx_buffer[port->rx_index++] = data;
 		}
 	}
-	status = UART_SetConfig(&huart1);
-	if(status == HAL_OK)
+
+	// The receiver timeout marks the end of the frame, clear it before the HAL treats it as an error
+	if(isrflags & USART_ISR_RTOF)
 	{
-		// Log error, reset UART
-		status = modbus_reset();
-		if(status != HAL_OK)
+		__HAL_UART_CLEAR_FLAG(port->huart, UART_CLEAR_RTOF);
+		port->rx_discard = 0;
+		if(port->rx_index > 0)
 		{
-			return status;
+			modbus_frame_complete(port, port->rx_index);
+			port->rx_index = 0;
 		}
 	}
-
-	return modbus_set_rx();
 }
+#endif
 
-int8_t modbus_set_baud_rate(uint8_t baud_rate)
+int8_t modbus_configure_fifo(modbus_port_t *port)
 {
-	int8_t status = HAL_OK;
-	/* Designed to hold baud rate in emulated EEPROM
-	if(ee.modbus_baud_rate != baud_rate)
+	int8_t status = HAL_UARTEx_SetTxFifoThreshold(port->huart, MODBUS_TX_FIFO_THRESHOLD);
+	status |= HAL_UARTEx_SetRxFifoThreshold(port->huart, MODBUS_RX_FIFO_THRESHOLD);
+	if(port->fifo_rx)
 	{
-		ee.modbus_baud_rate = baud_rate;
-
-		if(!EE_Write())
-		{
-			osMutexRelease(eeprom_mutexHandle);
-			return EE_WRITE_ERROR;
-		}
+		status |= HAL_UARTEx_EnableFifoMode(port->huart);
+		HAL_UART_ReceiverTimeout_Config(port->huart, MODBUS_RECEIVER_TIMEOUT);
+		status |= HAL_UART_EnableReceiverTimeout(port->huart);
+	}
+	else
+	{
+		status |= HAL_UARTEx_DisableFifoMode(port->huart);
 	}
-	*/
 	return status;
 }
 
-int8_t modbus_get_baud_rate(uint8_t* baud_rate)
+/*
+ * Hand the timestamps of the response that has just left to the latency statistics
+ */
+void modbus_record_latency(modbus_port_t *port)
 {
-	int8_t status = HAL_OK;
-
-	/* Designed to hold baud rate in emulated EEPROM
-	*baud_rate = ee.modbus_baud_rate;
-	*/
-	return status;
+	port->latency_state = LATENCY_STATE_IDLE;
+	latency_record(port->latency_function_code, port->latency_time);
 }
 
+/*
+ * The counters are also incremented from the UART interrupts
+ */
+void modbus_clear_counters(modbus_port_t *port)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	memset((void *)port->counter, 0, sizeof(port->counter));
+	__set_PRIMASK(primask);
+}
 
-// Low Level Functions -------------------------------------------------------------------------
-uint8_t get_rx_buffer(uint8_t index)
+/*
+ * USART1 runs from its own kernel clock mux, USART2 has none and is clocked from PCLK
+ */
+uint32_t modbus_kernel_clock(modbus_port_t *port)
 {
-	if (index < MODBUS_RX_BUFFER_SIZE)
+	if(port->huart->Instance == USART1)
 	{
-		return modbus_rx_buffer[index];
+		return HAL_RCCEx_GetPeriphCLKFreq(RCC_PERIPHCLK_USART1);
 	}
-	return 0xFF;
+	return HAL_RCC_GetPCLK1Freq();
 }
 
-int8_t handle_modbus_error(int8_t error_code)
+/*
+ * Search every kernel clock prescaler and both oversampling modes for the closest achievable rate
+ * Oversampling by 16 and the smallest prescaler win ties, as they give the receiver the best noise immunity
+ * config may be NULL to only check that the rate is achievable
+ */
+int8_t modbus_find_baud_config(uint32_t baud_rate, uint32_t kernel_clock, baud_config_t *config)
 {
-	holding_register_database[MB_ERRORS] |= 1U << (error_code - RANGE_ERROR);
-	return error_code;
-}
+	if(baud_rate < MODBUS_MIN_BAUD_RATE || baud_rate > MODBUS_MAX_BAUD_RATE)
+	{
+		return RANGE_ERROR;
+	}
 
-// Private Functions ---------------------------------------------------------------------------
+	baud_config_t best = {0};
+	uint32_t best_error = 0xFFFFFFFF;
+
+	for(uint32_t prescaler = UART_PRESCALER_DIV1; prescaler <= UART_PRESCALER_DIV256; prescaler++)
+	{
+		uint32_t clock = kernel_clock / UARTPrescTable[prescaler];
+		for(uint8_t over8 = 0; over8 <= 1; over8++)
+		{
+			// USARTDIV is the number of prescaled kernel clocks per bit, doubled when oversampling by 8
+			uint32_t usartdiv = ((clock << over8) + (baud_rate / 2)) / baud_rate;
+			if(usartdiv < USARTDIV_MIN || usartdiv > USARTDIV_MAX)
+			{
+				continue;
+			}
+			uint32_t actual_baud_rate = (clock << over8) / usartdiv;
+			uint32_t error = (actual_baud_rate > baud_rate) ? (actual_baud_rate - baud_rate) : (baud_rate - actual_baud_rate);
+			if(error < best_error)
+			{
+				best_error = error;
+				best.over_sampling = over8 ? UART_OVERSAMPLING_8 : UART_OVERSAMPLING_16;
+				best.prescaler = prescaler;
+				best.actual_baud_rate = actual_baud_rate;
+				best.error = (int32_t)(((int64_t)actual_baud_rate - baud_rate) * 1000000 / baud_rate);
+			}
+		}
+	}
+
+	if(best_error == 0xFFFFFFFF || best.error > MODBUS_MAX_BAUD_ERROR || best.error < -MODBUS_MAX_BAUD_ERROR)
+	{
+		return RANGE_ERROR;
+	}
+	if(config != NULL)
+	{
+		(*config) = best;
+	}
+	return MB_SUCCESS;
+}
 
 uint16_t crc_16(uint8_t *data, uint8_t size)
 {
@@ -774,17 +3001,17 @@ uint16_t crc_16(uint8_t *data, uint8_t size)
 	return (crc_hi << 8 | crc_low);
 }
 
-int8_t handle_chunk_miss()
+int8_t handle_chunk_miss(modbus_port_t *port)
 {
-	if(modbus_header == 0)
+	if(port->header == 0)
 	{
-		if(HAL_GetTick() - chunk_time > 10)
+		if(timer_expired(port->chunk_timer))
 		{
-			modbus_header = 1;
-			int8_t status = HAL_UART_Abort(&huart1);
+			port->header = 1;
+			int8_t status = HAL_UART_Abort(port->huart);
 			if(status == HAL_OK)
 			{
-				status = modbus_set_rx();
+				status = modbus_port_set_rx(port);
 			}
 			return status;
 		}
@@ -0,0 +1,170 @@
+/*
+ * profile.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: Victor Kalenda
+ *
+ */
+
+#include "profile.h"
+#include "error_codes.h"
+#include "modbus.h"
+#include "stm32c0xx_hal.h"
+#include <stdint.h>
+#include <string.h>
+
+typedef struct profile_entry_s
+{
+	uint32_t pc;
+	uint16_t count;
+}profile_entry_t;
+
+static profile_entry_t profile[PROFILE_SIZE];
+static volatile uint8_t profile_running = 0;
+static uint32_t profile_samples = 0;
+static uint32_t profile_lost = 0;
+static uint32_t profile_idle_samples = 0;
+static volatile uint8_t idle_tick = 0; // The pending SysTick fell due in Sleep
+
+// Private Functions
+uint16_t profile_register(uint16_t record);
+
+void profile_start()
+{
+	profile_running = 0;
+	memset(profile, 0, sizeof(profile));
+	profile_samples = 0;
+	profile_lost = 0;
+	profile_idle_samples = 0;
+	idle_tick = 0;
+	profile_running = 1;
+}
+
+void profile_stop()
+{
+	profile_running = 0;
+}
+
+/*
+ * Called by SysTick_Profile_Handler (startup_stm32c071cbtx.s) with the PC stacked by the SysTick interrupt
+ */
+void profile_sample(uint32_t pc)
+{
+	if(!profile_running)
+	{
+		return;
+	}
+	profile_samples++;
+	if(idle_tick)
+	{
+		idle_tick = 0;
+		profile_idle_samples++;
+		return;
+	}
+
+	// Fibonacci hashing of the halfword address, then a short linear probe
+	uint16_t index = ((pc >> 1) * 2654435769U) >> 24;
+	for(uint8_t i = 0; i < PROFILE_PROBES; i++)
+	{
+		profile_entry_t *entry = &profile[(index + i) % PROFILE_SIZE];
+		if(entry->count == 0)
+		{
+			entry->pc = pc;
+			entry->count = 1;
+			return;
+		}
+		if(entry->pc == pc)
+		{
+			if(entry->count < 0xFFFF)
+			{
+				entry->count++;
+			}
+			return;
+		}
+	}
+	profile_lost++;
+}
+
+/*
+ * Called by idle_sleep() with PRIMASK still set when the SysTick is pending, so its sample is taken as idle time
+ */
+void profile_idle()
+{
+	idle_tick = profile_running;
+}
+
+/*
+ * Copy length registers of the profile file from record on into data, high byte first
+ */
+int8_t profile_read(uint16_t record, uint16_t length, uint8_t *data)
+{
+	if((uint32_t)record + length > PROFILE_FILE_SIZE)
+	{
+		return MB_ILLEGAL_DATA_ADDRESS;
+	}
+	for(uint16_t i = 0; i < length; i++)
+	{
+		uint16_t value = profile_register(record + i);
+		data[2 * i] = (value >> 8) & 0xFF;
+		data[2 * i + 1] = value & 0xFF;
+	}
+	return MB_SUCCESS;
+}
+
+// Private Functions ---------------------------------------------------------------------------
+
+uint16_t profile_register(uint16_t record)
+{
+	switch(record)
+	{
+		case 0:
+		{
+			return (profile_samples >> 16) & 0xFFFF;
+		}
+		case 1:
+		{
+			return profile_samples & 0xFFFF;
+		}
+		case 2:
+		{
+			return (profile_lost >> 16) & 0xFFFF;
+		}
+		case 3:
+		{
+			return profile_lost & 0xFFFF;
+		}
+		case 4:
+		{
+			return (profile_idle_samples >> 16) & 0xFFFF;
+		}
+		case 5:
+		{
+			return profile_idle_samples & 0xFFFF;
+		}
+		case 6:
+		{
+			return PROFILE_SIZE;
+		}
+		case 7:
+		{
+			return PROFILE_ENTRY_SIZE;
+		}
+	}
+
+	const profile_entry_t *entry = &profile[(record - PROFILE_FILE_HEADER) / PROFILE_ENTRY_SIZE];
+	switch((record - PROFILE_FILE_HEADER) % PROFILE_ENTRY_SIZE)
+	{
+		case 0:
+		{
+			return (entry->pc >> 16) & 0xFFFF;
+		}
+		case 1:
+		{
+			return entry->pc & 0xFFFF;
+		}
+		default:
+		{
+			return entry->count;
+		}
+	}
+}
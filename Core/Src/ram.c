@@ -0,0 +1,59 @@
+/*
+ * ram.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: Victor Kalenda
+ *
+ */
+
+#include "ram.h"
+#include "stm32c0xx_hal.h"
+#include <stdint.h>
+
+// Linker script symbols, only their addresses are meaningful
+extern uint32_t _sdata;
+extern uint32_t _edata;
+extern uint32_t _sbss;
+extern uint32_t _ebss;
+extern uint32_t _end;
+extern uint32_t _estack;
+extern uint8_t _Min_Stack_Size;
+
+static uint32_t *stack_mark = &_estack; // Lowest word written so far
+static uint32_t *scan = &_end;
+
+/*
+ * Move the scan up by RAM_SCAN_WORDS words, call once per super-loop iteration
+ */
+void ram_service()
+{
+	for(uint8_t i = 0; i < RAM_SCAN_WORDS; i++)
+	{
+		if(scan >= stack_mark)
+		{
+			scan = &_end;
+			return;
+		}
+		if(*scan != RAM_PAINT)
+		{
+			stack_mark = scan;
+			scan = &_end;
+			return;
+		}
+		scan++;
+	}
+}
+
+/*
+ * Copy the RAM budget into the register block starting at registers, see ram.h for the layout
+ */
+void ram_export(uint16_t *registers)
+{
+	registers[0] = (uint32_t)&_estack - SRAM_BASE;
+	registers[1] = (uint32_t)&_edata - (uint32_t)&_sdata;
+	registers[2] = (uint32_t)&_ebss - (uint32_t)&_sbss;
+	registers[3] = (uint32_t)&_end - (uint32_t)&_ebss;
+	registers[4] = (uint32_t)&_Min_Stack_Size;
+	registers[5] = (uint32_t)&_estack - (uint32_t)stack_mark;
+	registers[6] = (uint32_t)stack_mark - (uint32_t)&_end;
+}
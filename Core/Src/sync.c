@@ -0,0 +1,98 @@
+/*
+ * sync.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: Victor Kalenda
+ *
+ */
+
+#include "sync.h"
+#include "timer.h"
+#include "main.h"
+#include <stdint.h>
+
+sync_stats_t sync_stats = {0};
+
+// Bus time = TIM2 count + offset
+static uint32_t offset = 0;
+static volatile uint32_t scheduled_time = 0; // Local TIM2 count of the activation time
+static volatile uint8_t scheduled_gpio = 0;
+
+// Private Functions
+void sync_fire();
+
+/*
+ * Record the offset between the bus and local time, local_time is the TIM2 count when the epoch frame completed
+ */
+void sync_set_epoch(uint32_t bus_time, uint32_t local_time)
+{
+	offset = bus_time - local_time;
+	timer_start(TIMER_SYNC_HOLD, SYNC_HOLD_TIME, NULL);
+}
+
+uint8_t sync_get_state()
+{
+	if(timer_running(TIMER_RELAY_SCHEDULE))
+	{
+		return SYNC_STATE_SCHEDULED;
+	}
+	return timer_running(TIMER_SYNC_HOLD) ? SYNC_STATE_LOCKED : SYNC_STATE_FREE;
+}
+
+uint32_t sync_bus_time()
+{
+	return timer_now() + offset;
+}
+
+/*
+ * Switch the relays to gpio_state at the given bus time
+ * A time that has already passed switches straight away, the lateness shows up in the skew
+ */
+void sync_schedule(uint32_t bus_time, uint8_t gpio_state)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	scheduled_time = bus_time - offset;
+	scheduled_gpio = gpio_state;
+	int32_t delay = (int32_t)(scheduled_time - timer_now());
+	timer_start_us(TIMER_RELAY_SCHEDULE, (delay > 0) ? (uint32_t)delay : 0, sync_fire);
+
+	__set_PRIMASK(primask);
+}
+
+void sync_cancel()
+{
+	timer_stop(TIMER_RELAY_SCHEDULE);
+}
+
+/*
+ * Returns 1 once after a scheduled change has been applied to the outputs, along with the new relay state
+ */
+uint8_t sync_fired(uint8_t *gpio_state)
+{
+	if(timer_expired(TIMER_RELAY_SCHEDULE))
+	{
+		(*gpio_state) = scheduled_gpio;
+		return 1;
+	}
+	return 0;
+}
+
+// Private Functions ---------------------------------------------------------------------------
+
+/*
+ * Runs from the TIM2 compare interrupt at the activation time
+ */
+void sync_fire()
+{
+	HAL_GPIO_WritePin(RELAY_120_GPIO_Port, RELAY_120_Pin, (scheduled_gpio & RELAY_120_MASK));
+	HAL_GPIO_WritePin(RELAY_480_GPIO_Port, RELAY_480_Pin, (scheduled_gpio & RELAY_480_MASK));
+
+	uint32_t late = timer_now() - scheduled_time;
+	sync_stats.skew = (late > 0xFFFF) ? 0xFFFF : (uint16_t)late;
+	if(sync_stats.skew > sync_stats.skew_max)
+	{
+		sync_stats.skew_max = sync_stats.skew;
+	}
+}
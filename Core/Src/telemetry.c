@@ -0,0 +1,201 @@
+/*
+ * telemetry.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: Victor Kalenda
+ *
+ */
+
+#include "telemetry.h"
+#include "modbus.h"
+#include "main.h"
+#include "timer.h"
+#include "clock.h"
+#include "ee.h"
+#include <stdint.h>
+
+#define TELEMETRY_INTERVAL_MAX 60000 // ms
+#define high_byte(value) ((value >> 8) & 0xFF)
+#define low_byte(value) (value & 0xFF)
+
+telemetry_stats_t telemetry_stats = {0};
+
+static uint8_t record[TELEMETRY_RECORD_SIZE]; // DMA source, only refilled once the previous record has left
+static uint8_t streaming = 0;
+static uint8_t record_due = 0;
+static uint32_t due = 0; // TIM2 time of the next periodic record
+static uint16_t sequence = 0;
+static uint16_t loop_count = 0;
+static uint16_t sent_gpio_read = 0;
+static uint16_t sent_gpio_write = 0;
+static volatile uint32_t edge_time = 0;
+static volatile uint8_t edge_pending = 0;
+
+// External Variables
+extern UART_HandleTypeDef huart2;
+extern uint16_t holding_register_database[];
+extern ee_storage_t ee;
+
+// Private Functions
+void telemetry_send();
+void telemetry_put_32(uint8_t *buffer, uint32_t value);
+
+/*
+ * Load the stream settings from the emulated EEPROM, so a logger keeps receiving after a power cycle
+ */
+void telemetry_restore()
+{
+	if((ee.telemetry_mode & ~TELEMETRY_MODE_MASK) == 0)
+	{
+		holding_register_database[TELEMETRY_MODE] = ee.telemetry_mode;
+	}
+	if(ee.telemetry_interval >= 1 && ee.telemetry_interval <= TELEMETRY_INTERVAL_MAX)
+	{
+		holding_register_database[TELEMETRY_INTERVAL] = ee.telemetry_interval;
+	}
+}
+
+void telemetry_store()
+{
+	if(ee.telemetry_mode != holding_register_database[TELEMETRY_MODE] ||
+	   ee.telemetry_interval != holding_register_database[TELEMETRY_INTERVAL])
+	{
+		ee.telemetry_mode = holding_register_database[TELEMETRY_MODE];
+		ee.telemetry_interval = holding_register_database[TELEMETRY_INTERVAL];
+		EE_Write();
+	}
+}
+
+/*
+ * Start or stop the stream with TELEMETRY_MODE and MB2_ROLE, and send a record when one is due and the line is free
+ * Runs once per super-loop iteration, after GPIO_READ and GPIO_WRITE have been brought up to date
+ */
+void telemetry_service()
+{
+	uint8_t mode = holding_register_database[TELEMETRY_MODE];
+	if(loop_count < 0xFFFF)
+	{
+		loop_count++;
+	}
+
+	if(mode == TELEMETRY_OFF || modbus_port_role(MODBUS_PORT_2) != MODBUS_ROLE_DISABLED)
+	{
+		if(streaming)
+		{
+			streaming = 0;
+			timer_stop(TIMER_TELEMETRY);
+		}
+		return;
+	}
+
+	// The timer only exists to wake the super-loop, consume its event
+	timer_expired(TIMER_TELEMETRY);
+
+	uint32_t now = timer_now();
+	if(!streaming)
+	{
+		// The logger gets the full state straight away
+		streaming = 1;
+		record_due = 1;
+		due = now;
+	}
+
+	if((mode & TELEMETRY_PERIODIC) && (int32_t)(now - due) >= 0)
+	{
+		if(record_due && telemetry_stats.overruns < 0xFFFF)
+		{
+			// The line has not been free for a whole period
+			telemetry_stats.overruns++;
+		}
+		record_due = 1;
+
+		uint32_t interval = holding_register_database[TELEMETRY_INTERVAL] * TIMER_TICKS_PER_MS;
+		due += interval;
+		if((int32_t)(due - now) <= 0)
+		{
+			due = now + interval;
+		}
+		timer_start_us(TIMER_TELEMETRY, due - now, NULL);
+	}
+
+	if((mode & TELEMETRY_ON_CHANGE) && (edge_pending ||
+	   sent_gpio_read != holding_register_database[GPIO_READ] || sent_gpio_write != holding_register_database[GPIO_WRITE]))
+	{
+		record_due = 1;
+	}
+
+	// A record still on the line completes with an interrupt, which brings the super-loop back here
+	if(record_due && huart2.gState == HAL_UART_STATE_READY)
+	{
+		telemetry_send();
+	}
+}
+
+/*
+ * Input edge, called from the EXTI callbacks
+ */
+void telemetry_edge()
+{
+	edge_time = timer_now();
+	edge_pending = 1;
+}
+
+/*
+ * Returns 1 if the core may stop its clocks, USART2 cannot run from Stop and its baud rate follows PCLK
+ */
+uint8_t telemetry_idle()
+{
+	return !streaming;
+}
+
+// Private Functions ---------------------------------------------------------------------------
+
+void telemetry_send()
+{
+	uint16_t gpio_read = holding_register_database[GPIO_READ];
+	uint16_t gpio_write = holding_register_database[GPIO_WRITE];
+	uint16_t overruns = modbus_stats[MODBUS_PORT_1].overruns & 0xFFFF;
+	edge_pending = 0;
+
+	record[0] = TELEMETRY_SYNC;
+	record[1] = TELEMETRY_RECORD_SIZE;
+	record[2] = high_byte(sequence);
+	record[3] = low_byte(sequence);
+	telemetry_put_32(&record[4], timer_now());
+	record[8] = high_byte(gpio_read);
+	record[9] = low_byte(gpio_read);
+	record[10] = high_byte(gpio_write);
+	record[11] = low_byte(gpio_write);
+	telemetry_put_32(&record[12], edge_time);
+	record[16] = high_byte(holding_register_database[MB_ERRORS]);
+	record[17] = low_byte(holding_register_database[MB_ERRORS]);
+	record[18] = high_byte(overruns);
+	record[19] = low_byte(overruns);
+	record[20] = high_byte(loop_count);
+	record[21] = low_byte(loop_count);
+	uint16_t crc = crc_16(record, TELEMETRY_RECORD_SIZE - 2);
+	record[22] = low_byte(crc);
+	record[23] = high_byte(crc);
+
+	// USART2 follows PCLK, raise the clock now rather than under the record on the next pass
+	clock_wake();
+	if(HAL_UART_Transmit_DMA(&huart2, record, TELEMETRY_RECORD_SIZE) != HAL_OK)
+	{
+		// Still due, tried again on the next pass
+		return;
+	}
+	record_due = 0;
+	sent_gpio_read = gpio_read;
+	sent_gpio_write = gpio_write;
+	loop_count = 0;
+	sequence++;
+	telemetry_stats.records++;
+}
+
+void telemetry_put_32(uint8_t *buffer, uint32_t value)
+{
+	buffer[0] = (value >> 24) & 0xFF;
+	buffer[1] = (value >> 16) & 0xFF;
+	buffer[2] = (value >> 8) & 0xFF;
+	buffer[3] = value & 0xFF;
+}
@@ -0,0 +1,255 @@
+/*
+ * timer.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: Victor Kalenda
+ *
+ */
+
+#include "timer.h"
+#include "main.h"
+#include <stdint.h>
+
+typedef struct soft_timer_s
+{
+	uint32_t deadline;
+	timer_callback_t callback;
+}soft_timer_t;
+
+// Timer table
+static soft_timer_t timers[NUM_TIMERS];
+static volatile uint32_t armed_timers = 0;
+static volatile uint32_t expired_timers = 0;
+
+// Compare channel state
+static volatile uint32_t next_deadline = 0;
+static volatile uint8_t compare_armed = 0;
+
+// External Variables
+extern TIM_HandleTypeDef htim2;
+
+// Private Functions
+void schedule_compare(uint32_t deadline);
+void reschedule_compare();
+
+void timer_init()
+{
+	armed_timers = 0;
+	expired_timers = 0;
+	compare_armed = 0;
+	__HAL_TIM_DISABLE_IT(&htim2, TIM_IT_CC1);
+	__HAL_TIM_CLEAR_FLAG(&htim2, TIM_FLAG_CC1);
+	HAL_TIM_Base_Start(&htim2);
+}
+
+void timer_start(timer_id_t id, uint32_t ms, timer_callback_t callback)
+{
+	timer_start_us(id, ms * TIMER_TICKS_PER_MS, callback);
+}
+
+void timer_start_us(timer_id_t id, uint32_t us, timer_callback_t callback)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	uint32_t deadline = timer_now() + us;
+	timers[id].deadline = deadline;
+	timers[id].callback = callback;
+	armed_timers |= 1U << id;
+	expired_timers &= ~(1U << id);
+
+	// Only touch the compare register if this timer is now the earliest deadline
+	if(!compare_armed || (int32_t)(deadline - next_deadline) < 0)
+	{
+		schedule_compare(deadline);
+	}
+
+	__set_PRIMASK(primask);
+}
+
+void timer_stop(timer_id_t id)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	// The compare channel is left alone, a stale compare simply finds nothing to expire
+	armed_timers &= ~(1U << id);
+	expired_timers &= ~(1U << id);
+
+	__set_PRIMASK(primask);
+}
+
+uint8_t timer_running(timer_id_t id)
+{
+	return (armed_timers >> id) & 0x01;
+}
+
+uint8_t timer_expired(timer_id_t id)
+{
+	uint8_t expired = 0;
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	if(expired_timers & (1U << id))
+	{
+		expired_timers &= ~(1U << id);
+		expired = 1;
+	}
+
+	__set_PRIMASK(primask);
+	return expired;
+}
+
+/*
+ * Retrieve the time until the next armed timer is due
+ * Returns 0 if no timer is armed, in which case nothing is scheduled to wake the CPU
+ */
+uint8_t timer_next_expiry(uint32_t *us)
+{
+	uint8_t found = 0;
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	if(armed_timers != 0)
+	{
+		int32_t remaining = (int32_t)(next_deadline - timer_now());
+		(*us) = (remaining > 0) ? (uint32_t)remaining : 0;
+		found = 1;
+	}
+
+	__set_PRIMASK(primask);
+	return found;
+}
+
+/*
+ * Rescale TIM2 to keep counting in microseconds after the timer clock changes
+ * The prescaler only loads on an update event, which also clears the counter, so the count is carried across
+ */
+void timer_set_clock(uint32_t timer_clock)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	uint32_t count = timer_now();
+	__HAL_TIM_SET_PRESCALER(&htim2, (timer_clock / (TIMER_TICKS_PER_MS * 1000U)) - 1);
+	htim2.Instance->EGR = TIM_EGR_UG;
+	__HAL_TIM_SET_COUNTER(&htim2, count);
+
+	__set_PRIMASK(primask);
+}
+
+/*
+ * Move TIM2 on by the time the core spent in Stop mode, where the counter stands still
+ * A deadline that fell due in Stop expires as soon as interrupts are enabled again
+ */
+void timer_advance(uint32_t us)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	__HAL_TIM_SET_COUNTER(&htim2, timer_now() + us);
+	if(compare_armed)
+	{
+		schedule_compare(next_deadline);
+	}
+
+	__set_PRIMASK(primask);
+}
+
+/*
+ * Returns 1 if any timer has expired and has not yet been consumed by timer_expired()
+ */
+uint8_t timer_pending()
+{
+	return expired_timers != 0;
+}
+
+uint32_t timer_now()
+{
+	return __HAL_TIM_GET_COUNTER(&htim2);
+}
+
+/*
+ * Compare match handler, called from the TIM2 interrupt
+ */
+void timer_irq_handler()
+{
+	uint32_t now = timer_now();
+	uint32_t fired = 0;
+
+	// Collect every timer that has reached its deadline
+	for(uint8_t id = 0; id < NUM_TIMERS; id++)
+	{
+		if((armed_timers & (1U << id)) && ((int32_t)(now - timers[id].deadline) >= 0))
+		{
+			fired |= 1U << id;
+		}
+	}
+	armed_timers &= ~fired;
+	expired_timers |= fired;
+	compare_armed = 0;
+
+	// Callbacks may re-arm their own timer, so run them before choosing the next deadline
+	for(uint8_t id = 0; id < NUM_TIMERS; id++)
+	{
+		if((fired & (1U << id)) && (timers[id].callback != NULL))
+		{
+			timers[id].callback();
+		}
+	}
+
+	reschedule_compare();
+}
+
+void HAL_TIM_OC_DelayElapsedCallback(TIM_HandleTypeDef *htim)
+{
+	if(htim->Instance == TIM2 && htim->Channel == HAL_TIM_ACTIVE_CHANNEL_1)
+	{
+		timer_irq_handler();
+	}
+}
+
+// Private Functions ---------------------------------------------------------------------------
+
+void schedule_compare(uint32_t deadline)
+{
+	next_deadline = deadline;
+	compare_armed = 1;
+	__HAL_TIM_SET_COMPARE(&htim2, TIM_CHANNEL_1, deadline);
+	__HAL_TIM_CLEAR_FLAG(&htim2, TIM_FLAG_CC1);
+	__HAL_TIM_ENABLE_IT(&htim2, TIM_IT_CC1);
+
+	// The counter may already have passed a very short deadline, force the compare event
+	if((int32_t)(deadline - timer_now()) <= 0)
+	{
+		htim2.Instance->EGR = TIM_EGR_CC1G;
+	}
+}
+
+void reschedule_compare()
+{
+	uint32_t now = timer_now();
+	uint32_t earliest = 0;
+	uint8_t found = 0;
+
+	for(uint8_t id = 0; id < NUM_TIMERS; id++)
+	{
+		if(armed_timers & (1U << id))
+		{
+			if(!found || (int32_t)(timers[id].deadline - now) < (int32_t)(earliest - now))
+			{
+				earliest = timers[id].deadline;
+				found = 1;
+			}
+		}
+	}
+
+	if(found)
+	{
+		schedule_compare(earliest);
+	}
+	else
+	{
+		__HAL_TIM_DISABLE_IT(&htim2, TIM_IT_CC1);
+	}
+}
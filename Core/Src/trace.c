@@ -0,0 +1,114 @@
+/*
+ * trace.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: Victor Kalenda
+ *
+ */
+
+#include "trace.h"
+#include "error_codes.h"
+#include "modbus.h"
+#include <stdint.h>
+
+static trace_entry_t trace[TRACE_SIZE];
+static uint32_t trace_count = 0; // Entries traced since power up, the next one goes to trace_count % TRACE_SIZE
+
+// Private Functions
+uint16_t trace_register(uint16_t record);
+
+/*
+ * Runs from the super-loop only, like the file reads, so no locking is needed
+ */
+void trace_record(const trace_entry_t *entry)
+{
+	trace[trace_count % TRACE_SIZE] = (*entry);
+	trace_count++;
+}
+
+/*
+ * Copy length registers of the trace file from record on into data, high byte first
+ */
+int8_t trace_read(uint16_t record, uint16_t length, uint8_t *data)
+{
+	if((uint32_t)record + length > TRACE_FILE_SIZE)
+	{
+		return MB_ILLEGAL_DATA_ADDRESS;
+	}
+	for(uint16_t i = 0; i < length; i++)
+	{
+		uint16_t value = trace_register(record + i);
+		data[2 * i] = (value >> 8) & 0xFF;
+		data[2 * i + 1] = value & 0xFF;
+	}
+	return MB_SUCCESS;
+}
+
+// Private Functions ---------------------------------------------------------------------------
+
+uint16_t trace_register(uint16_t record)
+{
+	uint32_t held = (trace_count < TRACE_SIZE) ? trace_count : TRACE_SIZE;
+	switch(record)
+	{
+		case 0:
+		{
+			return (trace_count >> 16) & 0xFFFF;
+		}
+		case 1:
+		{
+			return trace_count & 0xFFFF;
+		}
+		case 2:
+		{
+			return held;
+		}
+		case 3:
+		{
+			return TRACE_ENTRY_SIZE;
+		}
+	}
+
+	uint16_t index = (record - TRACE_FILE_HEADER) / TRACE_ENTRY_SIZE;
+	if(index >= held)
+	{
+		return 0;
+	}
+	uint32_t sequence = trace_count - held + index;
+	const trace_entry_t *entry = &trace[sequence % TRACE_SIZE];
+	switch((record - TRACE_FILE_HEADER) % TRACE_ENTRY_SIZE)
+	{
+		case 0:
+		{
+			return sequence & 0xFFFF;
+		}
+		case 1:
+		{
+			return (entry->time >> 16) & 0xFFFF;
+		}
+		case 2:
+		{
+			return entry->time & 0xFFFF;
+		}
+		case 3:
+		{
+			return (entry->id << 8) | entry->function_code;
+		}
+		case 4:
+		{
+			return entry->address;
+		}
+		case 5:
+		{
+			return entry->quantity;
+		}
+		case 6:
+		{
+			return (entry->port << 8) | entry->result;
+		}
+		default:
+		{
+			return entry->response_time;
+		}
+	}
+}
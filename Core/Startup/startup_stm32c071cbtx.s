@@ -51,6 +51,20 @@ defined in linker script */
 Reset_Handler:
   ldr   r0, =_estack
   mov   sp, r0          /* set stack pointer */
+
+/* Paint the RAM above the static sections for the stack high-water mark, see ram.h */
+  ldr r2, =_end
+  ldr r3, =0xA5A5A5A5
+  b LoopPaintStack
+
+PaintStack:
+  str r3, [r2]
+  adds r2, r2, #4
+
+LoopPaintStack:
+  cmp r2, r0
+  bcc PaintStack
+
 /* Call the clock system initialization function.*/
   bl  SystemInit
 
@@ -109,6 +123,61 @@ Default_Handler:
 Infinite_Loop:
   b Infinite_Loop
   .size Default_Handler, .-Default_Handler
+
+/**
+ * @brief  SysTick entry, hands the PC stacked by the interrupt to profile_sample()
+ *         before running SysTick_Handler, see profile.h
+ *
+ * @param  None
+ * @retval : None
+*/
+    .section .text.SysTick_Profile_Handler,"ax",%progbits
+  .type SysTick_Profile_Handler, %function
+SysTick_Profile_Handler:
+  movs r0, #4
+  mov r1, lr
+  tst r0, r1            /* EXC_RETURN bit 2 selects the stack that holds the frame */
+  bne ProfileProcessStack
+  mrs r0, msp
+  b ProfileSample
+ProfileProcessStack:
+  mrs r0, psp
+ProfileSample:
+  ldr r0, [r0, #24]     /* Stacked PC */
+  push {r4, lr}
+  bl profile_sample
+  pop {r0, r1}
+  mov lr, r1
+  ldr r0, =SysTick_Handler
+  bx r0
+  .size SysTick_Profile_Handler, .-SysTick_Profile_Handler
+
+/**
+ * @brief  HardFault entry, hands the exception frame and EXC_RETURN to
+ *         fault_capture() before running HardFault_Handler, see fault.h
+ *
+ * @param  None
+ * @retval : None
+*/
+    .section .text.HardFault_Capture_Handler,"ax",%progbits
+  .type HardFault_Capture_Handler, %function
+HardFault_Capture_Handler:
+  movs r0, #4
+  mov r1, lr
+  tst r0, r1            /* EXC_RETURN bit 2 selects the stack that holds the frame */
+  bne FaultProcessStack
+  mrs r0, msp
+  b FaultCapture
+FaultProcessStack:
+  mrs r0, psp
+FaultCapture:
+  push {r4, lr}
+  bl fault_capture
+  pop {r0, r1}
+  mov lr, r1
+  ldr r0, =HardFault_Handler
+  bx r0
+  .size HardFault_Capture_Handler, .-HardFault_Capture_Handler
 /******************************************************************************
 *
 * The minimal vector table for a Cortex M0.  Note that the proper constructs
@@ -124,7 +193,7 @@ g_pfnVectors:
   .word  _estack
   .word  Reset_Handler
   .word  NMI_Handler
-  .word  HardFault_Handler
+  .word  HardFault_Capture_Handler
   .word  0
   .word  0
   .word  0
@@ -136,7 +205,7 @@ g_pfnVectors:
   .word  0
   .word  0
   .word  PendSV_Handler
-  .word  SysTick_Handler
+  .word  SysTick_Profile_Handler
   .word  WWDG_IRQHandler                   /* Window WatchDog                             */
   .word  PVD_VDDIO2_IRQHandler             /* PVD through EXTI Line detect                */
   .word  RTC_IRQHandler                    /* RTC through the EXTI line                   */
@@ -5,31 +5,73 @@
 
 # Add inputs and outputs from these tool invocations to the build variables 
 C_SRCS += \
+../Core/Src/clock.c \
+../Core/Src/diag.c \
+../Core/Src/fault.c \
+../Core/Src/gateway.c \
+../Core/Src/idle.c \
+../Core/Src/journal.c \
+../Core/Src/latency.c \
+../Core/Src/load.c \
 ../Core/Src/main.c \
 ../Core/Src/modbus.c \
+../Core/Src/profile.c \
+../Core/Src/ram.c \
 ../Core/Src/stm32c0xx_hal_msp.c \
 ../Core/Src/stm32c0xx_it.c \
+../Core/Src/sync.c \
 ../Core/Src/syscalls.c \
 ../Core/Src/sysmem.c \
-../Core/Src/system_stm32c0xx.c 
+../Core/Src/system_stm32c0xx.c \
+../Core/Src/telemetry.c \
+../Core/Src/timer.c \
+../Core/Src/trace.c 
 
 OBJS += \
+./Core/Src/clock.o \
+./Core/Src/diag.o \
+./Core/Src/fault.o \
+./Core/Src/gateway.o \
+./Core/Src/idle.o \
+./Core/Src/journal.o \
+./Core/Src/latency.o \
+./Core/Src/load.o \
 ./Core/Src/main.o \
 ./Core/Src/modbus.o \
+./Core/Src/profile.o \
+./Core/Src/ram.o \
 ./Core/Src/stm32c0xx_hal_msp.o \
 ./Core/Src/stm32c0xx_it.o \
+./Core/Src/sync.o \
 ./Core/Src/syscalls.o \
 ./Core/Src/sysmem.o \
-./Core/Src/system_stm32c0xx.o 
+./Core/Src/system_stm32c0xx.o \
+./Core/Src/telemetry.o \
+./Core/Src/timer.o \
+./Core/Src/trace.o 
 
 C_DEPS += \
+./Core/Src/clock.d \
+./Core/Src/diag.d \
+./Core/Src/fault.d \
+./Core/Src/gateway.d \
+./Core/Src/idle.d \
+./Core/Src/journal.d \
+./Core/Src/latency.d \
+./Core/Src/load.d \
 ./Core/Src/main.d \
 ./Core/Src/modbus.d \
+./Core/Src/profile.d \
+./Core/Src/ram.d \
 ./Core/Src/stm32c0xx_hal_msp.d \
 ./Core/Src/stm32c0xx_it.d \
+./Core/Src/sync.d \
 ./Core/Src/syscalls.d \
 ./Core/Src/sysmem.d \
-./Core/Src/system_stm32c0xx.d 
+./Core/Src/system_stm32c0xx.d \
+./Core/Src/telemetry.d \
+./Core/Src/timer.d \
+./Core/Src/trace.d 
 
 
 # Each subdirectory must supply rules for building sources it contributes
@@ -39,7 +81,7 @@ Core/Src/%.o Core/Src/%.su Core/Src/%.cyclo: ../Core/Src/%.c Core/Src/subdir.mk
 clean: clean-Core-2f-Src
 
 clean-Core-2f-Src:
-	-$(RM) ./Core/Src/main.cyclo ./Core/Src/main.d ./Core/Src/main.o ./Core/Src/main.su ./Core/Src/modbus.cyclo ./Core/Src/modbus.d ./Core/Src/modbus.o ./Core/Src/modbus.su ./Core/Src/stm32c0xx_hal_msp.cyclo ./Core/Src/stm32c0xx_hal_msp.d ./Core/Src/stm32c0xx_hal_msp.o ./Core/Src/stm32c0xx_hal_msp.su ./Core/Src/stm32c0xx_it.cyclo ./Core/Src/stm32c0xx_it.d ./Core/Src/stm32c0xx_it.o ./Core/Src/stm32c0xx_it.su ./Core/Src/syscalls.cyclo ./Core/Src/syscalls.d ./Core/Src/syscalls.o ./Core/Src/syscalls.su ./Core/Src/sysmem.cyclo ./Core/Src/sysmem.d ./Core/Src/sysmem.o ./Core/Src/sysmem.su ./Core/Src/system_stm32c0xx.cyclo ./Core/Src/system_stm32c0xx.d ./Core/Src/system_stm32c0xx.o ./Core/Src/system_stm32c0xx.su
+	-$(RM) ./Core/Src/clock.cyclo ./Core/Src/clock.d ./Core/Src/clock.o ./Core/Src/clock.su ./Core/Src/diag.cyclo ./Core/Src/diag.d ./Core/Src/diag.o ./Core/Src/diag.su ./Core/Src/fault.cyclo ./Core/Src/fault.d ./Core/Src/fault.o ./Core/Src/fault.su ./Core/Src/gateway.cyclo ./Core/Src/gateway.d ./Core/Src/gateway.o ./Core/Src/gateway.su ./Core/Src/idle.cyclo ./Core/Src/idle.d ./Core/Src/idle.o ./Core/Src/idle.su ./Core/Src/journal.cyclo ./Core/Src/journal.d ./Core/Src/journal.o ./Core/Src/journal.su ./Core/Src/latency.cyclo ./Core/Src/latency.d ./Core/Src/latency.o ./Core/Src/latency.su ./Core/Src/load.cyclo ./Core/Src/load.d ./Core/Src/load.o ./Core/Src/load.su ./Core/Src/main.cyclo ./Core/Src/main.d ./Core/Src/main.o ./Core/Src/main.su ./Core/Src/modbus.cyclo ./Core/Src/modbus.d ./Core/Src/modbus.o ./Core/Src/modbus.su ./Core/Src/profile.cyclo ./Core/Src/profile.d ./Core/Src/profile.o ./Core/Src/profile.su ./Core/Src/ram.cyclo ./Core/Src/ram.d ./Core/Src/ram.o ./Core/Src/ram.su ./Core/Src/stm32c0xx_hal_msp.cyclo ./Core/Src/stm32c0xx_hal_msp.d ./Core/Src/stm32c0xx_hal_msp.o ./Core/Src/stm32c0xx_hal_msp.su ./Core/Src/stm32c0xx_it.cyclo ./Core/Src/stm32c0xx_it.d ./Core/Src/stm32c0xx_it.o ./Core/Src/stm32c0xx_it.su ./Core/Src/sync.cyclo ./Core/Src/sync.d ./Core/Src/sync.o ./Core/Src/sync.su ./Core/Src/syscalls.cyclo ./Core/Src/syscalls.d ./Core/Src/syscalls.o ./Core/Src/syscalls.su ./Core/Src/sysmem.cyclo ./Core/Src/sysmem.d ./Core/Src/sysmem.o ./Core/Src/sysmem.su ./Core/Src/system_stm32c0xx.cyclo ./Core/Src/system_stm32c0xx.d ./Core/Src/system_stm32c0xx.o ./Core/Src/system_stm32c0xx.su ./Core/Src/telemetry.cyclo ./Core/Src/telemetry.d ./Core/Src/telemetry.o ./Core/Src/telemetry.su ./Core/Src/timer.cyclo ./Core/Src/timer.d ./Core/Src/timer.o ./Core/Src/timer.su ./Core/Src/trace.cyclo ./Core/Src/trace.d ./Core/Src/trace.o ./Core/Src/trace.su
 
 .PHONY: clean-Core-2f-Src
 
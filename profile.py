@@ -0,0 +1,120 @@
+from pymodbus.client import ModbusSerialClient as ModbusClient
+try:
+    from pymodbus.pdu.file_message import FileRecord
+except ImportError:
+    from pymodbus.file_message import FileRecord
+import argparse
+import bisect
+import subprocess
+import time
+
+# Profiles the firmware through the SysTick PC sampler (Core/Inc/profile.h) and prints the share of the samples
+# that landed in each function of the ELF file the board was programmed with.
+
+# Connection parameters
+PORT = 'COM3'
+BAUDRATE = 115200
+PARITY = 'N'
+UNIT_ID = 1
+STOPBITS = 1
+BYTESIZE = 8
+TIMEOUT = 2
+
+# Firmware layout, keep in step with Core/Inc/main.h and Core/Inc/profile.h
+PROFILE_CONTROL = 57
+PROFILE_STOP = 0
+PROFILE_RUN = 1
+MB_FILE_PROFILE = 3
+PROFILE_FILE_HEADER = 8
+READ_CHUNK = 120 # Registers per read file record request
+
+
+def read_file(client, modbus_id, record, length):
+    request = FileRecord(file_number=MB_FILE_PROFILE, record_number=record, record_length=length)
+    result = client.read_file_record([request], modbus_id)
+    if result.isError():
+        raise RuntimeError(f"Reading records {record} to {record + length - 1}: {result}")
+    data = result.records[0].record_data
+    return [(data[i] << 8) | data[i + 1] for i in range(0, len(data), 2)]
+
+
+def read_profile(client, modbus_id):
+    header = read_file(client, modbus_id, 0, PROFILE_FILE_HEADER)
+    samples = (header[0] << 16) | header[1]
+    lost = (header[2] << 16) | header[3]
+    idle = (header[4] << 16) | header[5]
+    size = header[6]
+    entry_size = header[7]
+
+    registers = []
+    end = PROFILE_FILE_HEADER + size * entry_size
+    for record in range(PROFILE_FILE_HEADER, end, READ_CHUNK):
+        registers += read_file(client, modbus_id, record, min(READ_CHUNK, end - record))
+
+    counts = {}
+    for i in range(0, len(registers) - entry_size + 1, entry_size):
+        pc = (registers[i] << 16) | registers[i + 1]
+        if registers[i + 2]:
+            counts[pc] = registers[i + 2]
+    return samples, lost, idle, counts
+
+
+def load_symbols(elf, nm):
+    output = subprocess.run([nm, '-n', '-S', '--defined-only', elf], capture_output=True, text=True, check=True).stdout
+    starts, ends, names = [], [], []
+    for line in output.splitlines():
+        fields = line.split()
+        if len(fields) != 4 or fields[2] not in 'tTwW':
+            continue
+        start = int(fields[0], 16) & ~1
+        starts.append(start)
+        ends.append(start + int(fields[1], 16))
+        names.append(fields[3])
+    return starts, ends, names
+
+
+def function_of(pc, symbols):
+    starts, ends, names = symbols
+    i = bisect.bisect_right(starts, pc) - 1
+    if i >= 0 and pc < ends[i]:
+        return names[i]
+    return f"0x{pc:08X}"
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Sample the PC of the power management board and print a flat profile")
+    parser.add_argument('--port', default=PORT)
+    parser.add_argument('--baud', type=int, default=BAUDRATE)
+    parser.add_argument('--id', type=int, default=UNIT_ID)
+    parser.add_argument('--elf', default='Debug/PowerManagementBoard.elf')
+    parser.add_argument('--nm', default='arm-none-eabi-nm')
+    parser.add_argument('--duration', type=float, default=10, help="seconds to sample for")
+    args = parser.parse_args()
+
+    client = ModbusClient(port=args.port, baudrate=args.baud, parity=PARITY, stopbits=STOPBITS, bytesize=BYTESIZE, timeout=TIMEOUT)
+    if not client.connect():
+        print(f"Unable to open {args.port}")
+        return
+
+    try:
+        client.write_registers(PROFILE_CONTROL, [PROFILE_RUN], args.id)
+        time.sleep(args.duration)
+        client.write_registers(PROFILE_CONTROL, [PROFILE_STOP], args.id)
+        samples, lost, idle, counts = read_profile(client, args.id)
+    finally:
+        client.close()
+
+    symbols = load_symbols(args.elf, args.nm)
+    # Ticks that fell due in Sleep are taken after interrupts are re-enabled in main(), the board counts them apart
+    functions = {'(sleep)': idle} if idle else {}
+    for pc, count in counts.items():
+        name = function_of(pc, symbols)
+        functions[name] = functions.get(name, 0) + count
+
+    print(f"{samples} samples, {lost} lost, {len(counts)} addresses")
+    for name, count in sorted(functions.items(), key=lambda item: item[1], reverse=True):
+        print(f"{count:8d} {100.0 * count / max(samples, 1):6.2f}%  {name}")
+
+
+if __name__ == '__main__':
+    main()